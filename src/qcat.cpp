@@ -1,6 +1,8 @@
 #include "qcat.h"
 #include "qcatdatasource.h"
 #include "qcatbin.h"
+#include "qcatlattice.h"
+#include "qcatresultcache.h"
 #include <math.h>
 #include <iostream>
 #include <boost/lexical_cast.hpp>
@@ -14,11 +16,6 @@ using namespace boost::timer;
 #define SERVER_SP_ARGS "totalrowcount bigint, zcount bigint, hz numeric, sum_surprise numeric"
 #define HASH_TYPE fht_string_concat
 
-#define BOOST_LOG_DYN_LINK 1
-#include <boost/log/trivial.hpp>
-#include <boost/log/utility/setup/file.hpp>
-namespace logging = boost::log;
-
 struct QCATLetterAndRecord : public QCATLetter
 {
 public:
@@ -48,6 +45,9 @@ void QCAT::init()
 	m_executionMethod = fem_client;
 	m_serverSPName = SERVER_SP_FUNC;
 	m_serverSPArgs = SERVER_SP_ARGS;
+	m_resultCaching = false;
+	m_profiling = false;
+	m_staging = fsm_none;
 }
 
 void QCAT::setSpec(QCATSpec spec)
@@ -63,29 +63,136 @@ QCATSummary QCAT::execute() const
 
 QCATSummary QCAT::operator()() const
 {
-    std::string error;
-    if(!isComplete(&error))
-        return QCATSummary(error);
+	std::string error;
+	if(!isComplete(&error))
+		return QCATSummary(error);
+
+	// a cached summary would carry no plan
+	if(!m_resultCaching || m_profiling) {
+		QCATSummary result = run();
+		if(m_profiling && result.success && !result.plan)
+			result.plan = profile(result.sql_used);
+		return result;
+	}
+
+	auto cache = m_db->resultCache();
+	const std::string version = cache->version(m_db.get());
+	const std::string key = resultCacheKey("summary");
 
-	return run();
+	QCATSummary cached;
+	if(!version.empty() && cache->getSummary(key, version, &cached))
+		return cached;
+
+	QCATSummary result = run();
+	if(!version.empty() && result.success)
+		cache->putSummary(key, version, result);
+	return result;
+}
+
+std::string QCAT::resultCacheKey(std::string kind) const
+{
+	// the generated SQL already captures VONs, bins, conditionals and limit; the method and
+	// server function decide how it is evaluated. Staging doesn't change results, so the key uses the
+	// unstaged SQL and a lookup never has to build a staging table.
+	std::stringstream ss;
+	ss << kind << "|" << m_executionMethod << "|" << m_serverSPName << "(" << m_serverSPArgs << ")|"
+		<< m_db->table() << "|" << sqlFrom("", std::vector<std::string>(), true);
+	return ss.str();
 }
 
 QCATSummary QCAT::run() const
 {
+	stage();
 	switch(m_executionMethod) {
 		case fem_server:
 			return serverRun();
 		case fem_client:
 			return clientRun();
+		default:
+			return QCATSummary("Unknown execution method.");
 	}
 }
 
-bool QCAT::isComplete(std::string* why) const
+static double elapsedSeconds(const boost::timer::cpu_timer& timer)
+{
+	return timer.elapsed().wall / 1e9;
+}
+
+/*
+ * Estimated size of a letter table: its buckets, a node (value and next pointer) per letter, and any
+ * key storage beyond the string object itself
+ */
+template<class Map>
+static size_t letterTableBytes(const Map& Z)
+{
+	size_t bytes = Z.bucket_count() * sizeof(void*) + Z.size() * (sizeof(typename Map::value_type) + sizeof(void*));
+	for(auto& item: Z) {
+		if(item.first.capacity() >= sizeof(std::string))
+			bytes += item.first.capacity() + 1;
+	}
+	return bytes;
+}
+
+void QCAT::markIfStopped(QCATSummary& summary, const QCATQueryControl* control)
+{
+	if(!control || !control->stopped())
+		return;
+
+	summary.success = false;
+	summary.message = control->timedOut() ? "QCAT timed out." : "QCAT cancelled.";
+}
+
+std::future<QCATSummary> QCAT::executeAsync(shared_ptr<QCATQueryControl> control) const
+{
+	QCAT q(*this);
+	q.m_control = control;
+	return std::async(std::launch::async, [q]() {
+		QCATSummary summary = q.execute();
+		markIfStopped(summary, q.m_control.get());
+		return summary;
+	});
+}
+
+std::future<QCATExplanation> QCAT::explainAsync(int topn, bool includeColumns, shared_ptr<QCATQueryControl> control) const
+{
+	QCAT q(*this);
+	q.m_control = control;
+	return std::async(std::launch::async, [q, topn, includeColumns]() mutable {
+		QCATExplanation explanation = q.explain(topn, includeColumns);
+		markIfStopped(explanation.summary, q.m_control.get());
+		return explanation;
+	});
+}
+
+std::future<std::vector<QCATRecord> > QCAT::topNMostSurprisingAsync(int n, bool includeColumns, shared_ptr<QCATQueryControl> control) const
+{
+	QCAT q(*this);
+	q.m_control = control;
+	return std::async(std::launch::async, [q, n, includeColumns]() {
+		auto records = q.topNMostSurprising(n, includeColumns);
+		if(q.m_control && q.m_control->stopped())
+			records.clear();
+		return records;
+	});
+}
+
+std::future<QCATSummaryAndSurprisals> QCAT::summaryAndSurprisalsAsync(shared_ptr<QCATQueryControl> control) const
+{
+	QCAT q(*this);
+	q.m_control = control;
+	return std::async(std::launch::async, [q]() {
+		QCATSummaryAndSurprisals result = q.summaryAndSurprisals();
+		markIfStopped(result.summary, q.m_control.get());
+		return result;
+	});
+}
+
+bool QCAT::isComplete(std::string* why, const std::set<std::string>& unfixed) const
 {
 	cout << "Checking..." << endl;
 
     for(auto cond: m_conditionals) {
-        if(!cond.second->isComplete()) {
+        if(!cond.second->isComplete() && !unfixed.count(cond.first)) {
             if(why) *why = "A conditional is not complete; QCAT not run.";
             return false;
         }
@@ -118,10 +225,10 @@ bool QCAT::isComplete(std::string* why) const
     return true;
 }
 
-bool QCAT::userCanRun() const
+bool QCAT::userCanRun(const std::set<std::string>& unfixed) const
 {
 	std::string err;
-	bool success = isComplete(&err);
+	bool success = isComplete(&err, unfixed);
 	if(!success)
 		std::cerr << err << std::endl;
 	return success;
@@ -145,24 +252,48 @@ shared_ptr<QCATBinStrategy> QCAT::binStrategy() const
 	return m_binStrategy;
 }
 
+void QCAT::materialiseBins(bool asIndexes)
+{
+	for(auto attr: attributes()) {
+		if(asIndexes)
+			attr.second->ensureBinIndex();
+		else
+			attr.second->ensureBinCacheColumn();
+	}
+}
+
 void QCAT::initialiseBinsFromStrategy(bool override_existing)
 {
+	if(!m_binStrategy)
+		return;
+
+	// resolve all attributes in one step so stats can be fetched in a single batch
+	std::vector<QCATAttribute*> targets;
 	for(auto attr: attributes()) {
-		if(override_existing || (!attr.second->hasBinStrategy()))
-			attr.second->setBinStrategy(m_binStrategy);
+		if(override_existing || (!attr.second->hasBinStrategy())) {
+			attr.second->setBinStrategy(m_binStrategy, false);
+			targets.push_back(attr.second.get());
+		}
 	}
+	m_binStrategy->apply(targets);
 }
 
 QCATSummary QCAT::serverRun() const
 {
 	if(!this->userCanRun()) return createFailureSummary(whyCantUserRun());
 
-    std::string sql = "SELECT * FROM " + m_serverSPName + "('" + sqlServerTableName() +
-        "','" + QCAT::escapeQuotes(sqlConditionals()) +
+	QCATQueryTimings timings;
+    boost::timer::cpu_timer cpu;
+
+	std::string conditions;
+	const std::string table = sqlServerTableName(&conditions);
+    std::string sql = "SELECT * FROM " + m_serverSPName + "('" + table +
+        "','" + QCAT::escapeQuotes(conditions) +
         "','" + sqlVONS() +"') AS f(" + m_serverSPArgs + ");";
+	timings.sql_generation = elapsedSeconds(cpu);
+
     bool success;
-    boost::timer::cpu_timer cpu;
-    QCATDBResult rows = m_db->executeSQL(sql,&success);
+    QCATDBResult rows = m_db->executeSQL(sql, &success, m_control.get(), &timings);
     boost::timer::cpu_times times = cpu.elapsed();
 
     if(!success) {
@@ -192,61 +323,53 @@ QCATSummary QCAT::serverRun() const
     result.record_length = rows->getInt(0,"totalrowcount");
     result.sql_used = sql;
     result.wall_time = times.wall / (float)1000000000LL;
+	result.timings = timings;
     result.uncertainty = result.entropy / log2(result.alphabet_size);
 	result.success = true;
 
+	// a plan of the function call would be a single opaque Function Scan; profile the rows it reads instead
+	if(m_profiling)
+		result.plan = profile("SELECT " + sqlVONSHashSelect() + " FROM " + table + " WHERE " + conditions);
+
     return result;
 }
 
 QCATSummary QCAT::clientRunSSE() const
 {
 	if(!this->userCanRun()) return createFailureSummary(whyCantUserRun());
+
+	QCATQueryTimings timings;
+	boost::timer::cpu_timer total, phase;
     
 	// set up our alphabet hashtable
     std::unordered_map<std::string,QCATLetter> Z;
 
     // execute QCAT
     const std::string sql = this->sql();
-    QCATDBResult rows = m_db->executeSQL(sql);
-    int totalRows = 0;
-
-    // add QCAT results to hashtable
-    for(int i=0;i<rows->nrows();i++) {
-        std::string hash(rows->get(i,"hash"));
-        Z[hash].count += 1;
-        totalRows++;
-    }
-	
-	const float oneOverTotalRows = 1.0/(float)totalRows;
+	timings.sql_generation = elapsedSeconds(phase);
 
-    // calculate overall entropy of Z
-    double HZ = 0;
-    double totalSurprise = 0;
-    for(auto item: Z) {
-        const float prob = item.second.count * oneOverTotalRows; 
-        const float log2prob = log2(prob);
-        item.second.prob = prob;
-        item.second.surprise = -log2prob;
+	bool success;
+    QCATDBResult rows = m_db->executeSQL(sql, &success, m_control.get(), &timings);
+	if(!queryCompleted(success))
+		return queryFailureSummary(sql);
 
-        HZ += prob * log2prob;
-        totalSurprise += -log2prob;
-    }
+    // add QCAT results to hashtable, decoding each letter as it is counted
+	phase.start();
+	const int hashCol = rows->colForName("hash");
+	for(int i=0;i<rows->nrows();i++)
+		Z[rows->get(i,hashCol)].count += 1;
+	timings.counting = elapsedSeconds(phase);
+	timings.peak_letter_memory = letterTableBytes(Z);
 
-    HZ = -HZ;
+	phase.start();
+    QCATSummary result = summaryFromLetters(Z);
+	timings.entropy = elapsedSeconds(phase);
 
     // compile results struct
-    QCATSummary result;
-	result.success = true;
     result.qcatid = m_spec.ID();
-	result.message = "Successfully run QCAT.";
-    result.entropy = HZ;
-    result.surprise_mean = totalSurprise / (float)Z.size();
-    result.surprise_stddev = 0; // TODO
-    result.alphabet_size = Z.size();
-    result.record_length = totalRows;
-    result.uncertainty = HZ / log2(result.alphabet_size);
     result.sql_used = sql;
-	result.success = true;
+	result.timings = timings;
+	result.wall_time = elapsedSeconds(total);
 
     return result;
 }
@@ -255,52 +378,461 @@ QCATSummary QCAT::clientRun() const
 {
 	if(!this->userCanRun()) return createFailureSummary(whyCantUserRun());
 
+	QCATQueryTimings timings;
+	boost::timer::cpu_timer total, phase;
+
 	// set up our alphabet hashtable
     std::unordered_map<std::string,QCATLetter> Z;
 
     // execute QCAT
     const std::string sql = this->sql();
-    QCATDBResult rows = m_db->executeSQL(sql);
-    int totalRows = 0;
-
-    // add QCAT results to hashtable
-    for(int i=0;i<rows->nrows();i++) {
-        std::string hash(rows->get(i,"hash"));
-        Z[hash].count += 1;
-        totalRows++;
-    }
+	timings.sql_generation = elapsedSeconds(phase);
+
+	bool success;
+    QCATDBResult rows = m_db->executeSQL(sql, &success, m_control.get(), &timings);
+	if(!queryCompleted(success))
+		return queryFailureSummary(sql);
+
+    // add QCAT results to hashtable, decoding each letter as it is counted
+	phase.start();
+	const int hashCol = rows->colForName("hash");
+	for(int i=0;i<rows->nrows();i++)
+		Z[rows->get(i,hashCol)].count += 1;
+	timings.counting = elapsedSeconds(phase);
+	timings.peak_letter_memory = letterTableBytes(Z);
 	
-	const float oneOverTotalRows = 1.0/(float)totalRows;
+	phase.start();
+    QCATSummary result = summaryFromLetters(Z);
+	timings.entropy = elapsedSeconds(phase);
+
+    // compile results struct
+	result.qcatid = m_spec.ID();
+    result.sql_used = sql;
+	result.timings = timings;
+	result.wall_time = elapsedSeconds(total);
+
+    return result;
+}
+
+QCATSummary QCAT::summaryFromCounts(const std::vector<double>& counts, std::vector<double>* surprisals)
+{
+	boost::timer::cpu_timer phase;
+	double totalRows = 0;
+	for(auto c: counts)
+		totalRows += c;
 
     // calculate overall entropy of Z
     double HZ = 0;
     double totalSurprise = 0;
-    for(auto item: Z) {
-        const float prob = item.second.count * oneOverTotalRows; 
-        const float log2prob = log2(prob);
-        item.second.prob = prob;
-        item.second.surprise = -log2prob;
-
-        HZ += prob * log2prob;
-        totalSurprise += -log2prob;
-    }
+	if(surprisals)
+		surprisals->resize(counts.size());
+	for(size_t i = 0; i < counts.size(); ++i) {
+		const double prob = counts[i] / totalRows;
+		const double log2prob = log2(prob);
+		HZ += prob * log2prob;
+		totalSurprise += -log2prob;
+		if(surprisals)
+			(*surprisals)[i] = -log2prob;
+	}
 
-    HZ = -HZ;
+	HZ = -HZ;
 
-    // compile results struct
     QCATSummary result;
 	result.success = true;
-	result.qcatid = m_spec.ID();
     result.message = "Successfully run QCAT.";
     result.entropy = HZ;
-    result.surprise_mean = totalSurprise / (float)Z.size();
+    result.surprise_mean = totalSurprise / (float)counts.size();
     result.surprise_stddev = 0; // TODO
-    result.alphabet_size = Z.size();
+    result.alphabet_size = counts.size();
     result.record_length = totalRows;
     result.uncertainty = HZ / log2(result.alphabet_size);
-    result.sql_used = sql;
+	result.timings.entropy = elapsedSeconds(phase);
+	return result;
+}
 
-    return result;
+QCATSummary QCAT::summaryFromLetters(std::unordered_map<std::string,QCATLetter>& Z)
+{
+	std::vector<double> counts, surprisals;
+	counts.reserve(Z.size());
+	for(auto& item: Z)
+		counts.push_back(item.second.count);
+
+	QCATSummary result = summaryFromCounts(counts, &surprisals);
+
+	// iteration order is unchanged, so surprisals line up with Z
+	auto s = surprisals.cbegin();
+	for(auto& item: Z) {
+		item.second.surprise = *s++;
+		item.second.prob = pow(2, -item.second.surprise);
+	}
+	return result;
+}
+
+std::map<int,QCATSummary> QCAT::binWidthSweep(std::vector<int> multipliers) const
+{
+	std::map<int,QCATSummary> results;
+	if(multipliers.empty()) {
+		for(int m = 1; m <= 64; m *= 2)
+			multipliers.push_back(m);
+	}
+
+	if(!userCanRun()) {
+		for(int m: multipliers)
+			results[m] = createFailureSummary(whyCantUserRun());
+		return results;
+	}
+	stage();
+
+	// count at the finest resolution; fixed-width VONs are floored so coarser bins are exact merges
+	std::vector<bool> fixedWidth;
+	std::string keys, groupBy;
+	int col = 0;
+	for(auto f: m_vons) {
+		auto bin = f.second->bin();
+		const std::string units = bin->sqlAttrToUnits(f.second->sqlUnbinned());
+		const std::string idx = boost::lexical_cast<std::string>(col++);
+		fixedWidth.push_back(!units.empty());
+		if(!units.empty())
+			keys += "CAST(floor(" + units + " / " + boost::lexical_cast<std::string>(bin->binWidth()) + ") AS bigint) AS _k" + idx + ",";
+		else
+			keys += "CAST(" + f.second->sqlNoAS() + " AS text) AS _k" + idx + ",";
+		groupBy += "_k" + idx + ",";
+	}
+
+	std::string conditions;
+	const std::string table = sqlServerTableName(&conditions);
+	const std::string sql = "SELECT " + keys + " COUNT(*) AS _cnt FROM " + table + 
+		" WHERE " + conditions + " GROUP BY " + groupBy.substr(0, groupBy.size()-1);
+
+	bool success;
+	QCATDBResult rows = m_db->executeSQL(sql, &success, m_control.get());
+	if(!success) {
+		for(int m: multipliers)
+			results[m] = createFailureSummary("There was a problem executing the bin width sweep.");
+		return results;
+	}
+
+	const int cntCol = rows->colForName("_cnt");
+	for(int m: multipliers) {
+		if(m < 1) {
+			results[m] = createFailureSummary("Bin width multipliers must be positive.");
+			continue;
+		}
+
+		// merge fine bins into letters at this width
+		std::unordered_map<std::string,double> Z;
+		for(int i = 0; i < rows->nrows(); ++i) {
+			std::string letter;
+			for(int j = 0; j < (int)fixedWidth.size(); ++j) {
+				if(fixedWidth[j]) {
+					const long long fine = atoll(rows->get(i,j));
+					letter += boost::lexical_cast<std::string>((long long)floor(fine / (double)m)) + ",";
+				}
+				else
+					letter += std::string(rows->get(i,j)) + ",";
+			}
+			Z[letter] += rows->getDouble(i,cntCol);
+		}
+
+		std::vector<double> counts;
+		for(auto& item: Z)
+			counts.push_back(item.second);
+
+		QCATSummary result = summaryFromCounts(counts);
+		result.qcatid = m_spec.ID();
+		result.sql_used = sql;
+		results[m] = result;
+	}
+
+	return results;
+}
+
+shared_ptr<QCATAttribute> QCAT::conditionalAttribute(std::string name) const
+{
+	auto existing = m_conditionals.find(name);
+	return existing != m_conditionals.end() ? existing->second->LHS() 
+		: make_shared<QCATAttribute>(m_db->fieldForName(name));
+}
+
+std::map<std::string,QCATSummary> QCAT::conditionalSweep(std::string conditional) const
+{
+	std::map<std::string,QCATSummary> results;
+	if(!userCanRun(std::set<std::string>({conditional})))
+		return results;
+
+	auto attr = conditionalAttribute(conditional);
+	if(!attr->OK())
+		return results;
+
+	// one pass: count letters per value of the conditional
+	const std::string sql = "SELECT CAST(" + attr->sqlNoAS() + " AS text) AS _cval, " + sqlVONSHashGroupBy() + " AS hash, COUNT(*) AS _cnt"
+		" FROM " + sqlLimitedTable(m_db->tableSafe()) + 
+		" WHERE " + sqlConditionals(std::set<std::string>({conditional})) + 
+		" GROUP BY 1, 2";
+
+	bool success;
+	QCATDBResult rows = m_db->executeSQL(sql, &success, m_control.get());
+	if(!success) {
+		std::cerr << "***Problem executing conditional sweep" << std::endl;
+		return results;
+	}
+
+	std::map<std::string,std::vector<double> > counts;
+	const int valCol = rows->colForName("_cval");
+	const int cntCol = rows->colForName("_cnt");
+	for(int i = 0; i < rows->nrows(); ++i)
+		counts[rows->get(i,valCol)].push_back(rows->getDouble(i,cntCol));
+
+	for(auto& item: counts) {
+		QCATSummary result = summaryFromCounts(item.second);
+		result.qcatid = m_spec.ID();
+		result.sql_used = sql;
+		results[item.first] = result;
+	}
+
+	return results;
+}
+
+QCATLattice QCAT::cube(std::vector<std::string> conditionals) const
+{
+	if(conditionals.empty()) {
+		for(auto& cond: m_conditionals) {
+			if(!cond.second->isComplete())
+				conditionals.push_back(cond.first);
+		}
+	}
+	if(conditionals.empty())
+		conditionals = m_spec.conditionals();
+
+	QCATLattice lattice(conditionals);
+	const std::set<std::string> dimensions(conditionals.begin(), conditionals.end());
+	if(!userCanRun(dimensions) || conditionals.empty())
+		return lattice;
+
+	std::vector<shared_ptr<QCATAttribute> > attrs;
+	for(auto c: conditionals) {
+		attrs.push_back(conditionalAttribute(c));
+		if(!attrs.back()->OK())
+			return lattice;
+	}
+
+	std::string selects, exprs;
+	for(size_t i = 0; i < attrs.size(); ++i) {
+		selects += "CAST(" + attrs[i]->sqlNoAS() + " AS text) AS _c" + boost::lexical_cast<std::string>(i) + ", ";
+		exprs += attrs[i]->sqlNoAS() + ",";
+	}
+	exprs = exprs.substr(0, exprs.size()-1);
+
+	// GROUPING() marks which cube conditionals were rolled up on each row
+	const std::string sql = "SELECT " + selects + "GROUPING(" + exprs + ") AS _g, " + sqlVONSHashGroupBy() + " AS hash, COUNT(*) AS _cnt"
+		" FROM " + sqlLimitedTable(m_db->tableSafe()) + 
+		" WHERE " + sqlConditionals(dimensions) + 
+		" GROUP BY " + sqlVONSHashGroupBy() + ", CUBE(" + exprs + ")";
+
+	bool success;
+	QCATDBResult rows = m_db->executeSQL(sql, &success, m_control.get());
+	if(!success) {
+		std::cerr << "***Problem executing QCAT cube" << std::endl;
+		return lattice;
+	}
+
+	const int n = conditionals.size();
+	const int gCol = rows->colForName("_g");
+	const int cntCol = rows->colForName("_cnt");
+	std::map<std::map<std::string,std::string>,std::vector<double> > counts;
+	for(int i = 0; i < rows->nrows(); ++i) {
+		const int g = rows->getInt(i,gCol);
+		std::map<std::string,std::string> fixed;
+		for(int j = 0; j < n; ++j) {
+			if(((g >> (n - 1 - j)) & 1) == 0)
+				fixed[conditionals[j]] = rows->get(i,j);
+		}
+		counts[fixed].push_back(rows->getDouble(i,cntCol));
+	}
+
+	for(auto& item: counts) {
+		QCATLatticeNode node;
+		node.fixed = item.first;
+		node.summary = summaryFromCounts(item.second);
+		node.summary.qcatid = m_spec.ID();
+		node.summary.sql_used = sql;
+		lattice.add(node);
+	}
+
+	return lattice;
+}
+
+QCATCountTable QCAT::countTable(std::vector<std::string> fields, bool* success, bool pairwise) const
+{
+	QCATCountTable table(fields);
+	if(success) *success = false;
+	if(fields.empty())
+		return table;
+	stage();
+
+	auto attrs = attributes();
+	const int F = fields.size();
+	std::vector<std::string> exprs;
+	std::string selects, groupBy;
+	for(int i = 0; i < F; ++i) {
+		auto attr = attrs.count(fields[i]) ? attrs[fields[i]] : make_shared<QCATAttribute>(m_db->fieldForName(fields[i]));
+		if(!attr->OK())
+			return table;
+		exprs.push_back(attr->sqlNoAS());
+		selects += "CAST(" + exprs[i] + " AS text) AS _v" + boost::lexical_cast<std::string>(i) + ", ";
+		groupBy += boost::lexical_cast<std::string>(i + 1) + ",";
+	}
+	groupBy = groupBy.substr(0, groupBy.size()-1);
+
+	if(pairwise) {
+		// one grouping set per field and per pair; GROUPING(e) is 1 in the rows where e was not grouped
+		std::string sets;
+		for(int i = 0; i < F; ++i) {
+			sets += "(" + exprs[i] + "),";
+			selects += "GROUPING(" + exprs[i] + ") AS _g" + boost::lexical_cast<std::string>(i) + ", ";
+			for(int j = i + 1; j < F; ++j)
+				sets += "(" + exprs[i] + "," + exprs[j] + "),";
+		}
+		groupBy = "GROUPING SETS (" + sets.substr(0, sets.size()-1) + ")";
+	}
+
+	std::string conditions;
+	const std::string from = sqlServerTableName(&conditions);
+	const std::string sql = "SELECT " + selects + "COUNT(*) AS _cnt FROM " + from + 
+		" WHERE " + conditions + " GROUP BY " + groupBy;
+
+	bool ok;
+	QCATDBResult rows = m_db->executeSQL(sql, &ok, m_control.get());
+	if(!ok)
+		return table;
+
+	const int cntCol = rows->colForName("_cnt");
+	std::vector<std::string> values(F);
+	for(int i = 0; i < rows->nrows(); ++i) {
+		if(!pairwise) {
+			for(int j = 0; j < F; ++j)
+				values[j] = rows->get(i,j);
+			table.add(values, rows->getDouble(i,cntCol));
+			continue;
+		}
+
+		std::vector<int> cols;
+		std::vector<std::string> grouped;
+		for(int j = 0; j < F; ++j) {
+			if(rows->getInt(i,F + j) == 0) {
+				cols.push_back(j);
+				grouped.push_back(rows->get(i,j));
+			}
+		}
+		table.addMarginal(cols, grouped, rows->getDouble(i,cntCol));
+	}
+
+	if(success) *success = true;
+	return table;
+}
+
+std::map<std::string,QCATBinStats> QCAT::vonHistograms() const
+{
+	std::vector<std::string> names;
+	std::vector<const QCATAttribute*> attrs;
+	for(auto& von: m_vons) {
+		names.push_back(von.first);
+		attrs.push_back(von.second.get());
+	}
+
+	auto stats = QCATBinStats::compileMany(attrs);
+
+	std::map<std::string,QCATBinStats> result;
+	for(size_t i = 0; i < names.size(); ++i)
+		result[names[i]] = stats[i];
+	return result;
+}
+
+QCATSummaryHeatmap QCAT::summaryHeatmap(std::vector<std::string> fields, bool uncertainty) const
+{
+	QCATSummaryHeatmap result;
+	result.fields = fields;
+	result.heatmapSize = 0;
+
+	bool success;
+	QCATCountTable table = countTable(fields, &success, true);
+	if(!success) {
+		std::cerr << "***Problem building QCAT heatmap" << std::endl;
+		return result;
+	}
+
+	const int F = fields.size();
+	for(int i = 0; i < F; ++i) {
+		auto& binvals = result.fieldbinvals[fields[i]];
+		const auto& vals = table.values(i);
+		for(size_t j = 0; j < vals.size(); ++j) {
+			try {
+				binvals.push_back(boost::lexical_cast<double>(vals[j]));
+			}
+			catch(boost::bad_lexical_cast& e) {
+				binvals.push_back(j);
+			}
+		}
+	}
+
+	result.heatmap = shared_ptr<double>(new double[F*F], std::default_delete<double[]>());
+	result.heatmapSize = F;
+	double* hm = result.heatmap.get();
+
+	// each cell is one grouping set of the query; the matrix is symmetric
+	for(int i = 0; i < F; ++i) {
+		for(int j = i; j < F; ++j) {
+			std::vector<int> cols = i == j ? std::vector<int>({i}) : std::vector<int>({i, j});
+			const std::vector<double> counts = table.marginalCounts(cols);
+			double v = QCATCountTable::entropy(counts, table.total());
+			if(uncertainty)
+				v = counts.size() > 1 ? v / log2(counts.size()) : 0;
+			hm[i*F + j] = hm[j*F + i] = v;
+		}
+	}
+
+	return result;
+}
+
+QCATInformation QCAT::information() const
+{
+	QCATInformation info;
+	if(!userCanRun()) {
+		info.summary = createFailureSummary(whyCantUserRun());
+		return info;
+	}
+
+	std::vector<std::string> names;
+	for(auto f: m_vons)
+		names.push_back(f.first);
+
+	bool success;
+	info.counts = countTable(names, &success);
+	if(!success) {
+		info.summary = createFailureSummary("There was a problem executing the QCAT.");
+		return info;
+	}
+
+	std::vector<int> all;
+	for(size_t i = 0; i < names.size(); ++i)
+		all.push_back(i);
+
+	// the joint letter over all VONs is Z itself
+	info.summary = summaryFromCounts(info.counts.marginalCounts(all));
+	info.summary.qcatid = m_spec.ID();
+
+	const double HZ = info.counts.entropy(all);
+	for(size_t i = 0; i < names.size(); ++i) {
+		std::vector<int> rest;
+		for(size_t j = 0; j < names.size(); ++j) {
+			if(j != i)
+				rest.push_back(j);
+		}
+		info.marginal_entropy[names[i]] = info.counts.entropy(std::vector<int>(1, i));
+		info.conditional_entropy[names[i]] = HZ - info.counts.entropy(rest);
+	}
+
+	return info;
 }
 
 QCATExplanation QCAT::explain(int topn, bool includeColumns) 
@@ -333,7 +865,7 @@ std::vector<QCATRecord> QCAT::topNMostSurprising(int n, std::vector<std::string>
     // execute QCAT
     const std::string sql = this->sql(additionalSelects);
 
-    QCATDBResult rows = m_db->executeSQL(sql);
+    QCATDBResult rows = m_db->executeSQL(sql, NULL, m_control.get());
     int totalRows = 0;
 
     // add QCAT results to hashtable
@@ -371,6 +903,20 @@ QCATSummary QCAT::createFailureSummary(std::string msg) const {
 	return sum;
 }
 
+bool QCAT::queryCompleted(bool success) const
+{
+	// a cancelled or timed out query may still have returned a partial or empty result
+	return success && !(m_control && m_control->stopped());
+}
+
+QCATSummary QCAT::queryFailureSummary(const std::string& sql) const
+{
+	QCATSummary sum = createFailureSummary("There was a problem executing the QCAT.");
+	sum.sql_used = sql;
+	markIfStopped(sum, m_control.get());
+	return sum;
+}
+
 QCATSummaryAndSurprisals QCAT::summaryAndSurprisals() const
 {
   	if(!userCanRun()) {
@@ -379,68 +925,78 @@ QCATSummaryAndSurprisals QCAT::summaryAndSurprisals() const
 		return sum;
 	}
 
+	if(!m_resultCaching || m_profiling) {
+		QCATSummaryAndSurprisals result = computeSummaryAndSurprisals();
+		if(m_profiling && result.summary.success)
+			result.summary.plan = profile(result.summary.sql_used);
+		return result;
+	}
+
+	auto cache = m_db->resultCache();
+	const std::string version = cache->version(m_db.get());
+	const std::string key = resultCacheKey("surprisals");
+
+	QCATSummaryAndSurprisals cached;
+	if(!version.empty() && cache->getSurprisals(key, version, &cached))
+		return cached;
+
+	QCATSummaryAndSurprisals result = computeSummaryAndSurprisals();
+	if(!version.empty() && result.summary.success)
+		cache->putSurprisals(key, version, result);
+	return result;
+}
+
+QCATSummaryAndSurprisals QCAT::computeSummaryAndSurprisals() const
+{
+	stage();
+
+	QCATQueryTimings timings;
+	boost::timer::cpu_timer total, phase;
+
 	// set up our alphabet hashtable
     std::unordered_map<std::string,QCATLetter> Z;
 
     // execute QCAT
     const std::string sql = this->sql();
-    QCATDBResult rows = m_db->executeSQL(sql);
-    int totalRows = 0;
-
-	std::vector<std::string> rowToHash(rows->nrows());
-	std::vector<std::string> rowToID(rows->nrows());
+	timings.sql_generation = elapsedSeconds(phase);
+
+	bool success;
+    QCATDBResult rows = m_db->executeSQL(sql, &success, m_control.get(), &timings);
+	if(!queryCompleted(success)) {
+		QCATSummaryAndSurprisals failed;
+		failed.summary = queryFailureSummary(sql);
+		return failed;
+	}
+	QCATSummaryAndSurprisals result;
+	result.surprisals.resize(rows->nrows());
 
-    // add QCAT results to hashtable
+    // add QCAT results to hashtable, decoding each letter as it is counted. Each row keeps a pointer to its
+	// letter (elements of an unordered_map stay put when it rehashes) to look its surprise up afterwards.
+	phase.start();
+	const int hashCol = rows->colForName("hash"), idCol = rows->colForName("id");
+	std::vector<const QCATLetter*> rowToLetter(rows->nrows());
     for(int i=0;i<rows->nrows();i++) {
-        std::string hash(rows->get(i,"hash"));
-        Z[hash].count += 1;
-		rowToHash[i] = hash;
-		rowToID[i] = rows->get(i,"id");
-        totalRows++;
-    }
-	const float oneOverTotalRows = 1.0/(float)totalRows;
-
-    // calculate overall entropy of Z
-    double HZ = 0;
-    double totalSurprise = 0;
-    for(auto &item: Z) {
-        const float prob = item.second.count * oneOverTotalRows; 
-        const float log2prob = log2(prob);
-
-		auto& second = item.second;
-        second.prob = prob;
-        second.surprise = -log2prob;
-		
-        HZ += prob * log2prob;
-        totalSurprise += -log2prob;
-    }
+		QCATLetter& letter = Z[rows->get(i,hashCol)];
+		letter.count += 1;
+		rowToLetter[i] = &letter;
+		result.surprisals[i].first = rows->get(i,idCol);
+	}
+	timings.counting = elapsedSeconds(phase);
+	timings.peak_letter_memory = letterTableBytes(Z);
 
-    HZ = -HZ;
+	phase.start();
+    QCATSummary sum = summaryFromLetters(Z);
+	timings.entropy = elapsedSeconds(phase);
 
     // compile results struct
-    QCATSummary sum;
-	sum.success = true;
 	sum.qcatid = m_spec.ID();
-    sum.message = "Successfully run QCAT.";
-    sum.entropy = HZ;
-    sum.surprise_mean = totalSurprise / (float)Z.size();
-    sum.surprise_stddev = 0; // TODO
-    sum.alphabet_size = Z.size();
-    sum.record_length = totalRows;
-    sum.uncertainty = HZ / log2(sum.alphabet_size);
     sum.sql_used = sql;
+	sum.timings = timings;
+	sum.wall_time = elapsedSeconds(total);
 
-	QCATSummaryAndSurprisals result;
 	result.summary = sum;
-	result.surprisals = std::vector<std::pair<std::string,double>>(totalRows);
-
-	auto sit = rowToHash.cbegin();
-	auto dit = result.surprisals.begin();
-	auto idit = rowToID.cbegin();
-
-	for( ; sit != rowToHash.cend(); ++sit, ++dit, ++idit) {
-		*dit = std::make_pair(*idit, Z[*sit].surprise);
-	}
+	for(size_t i = 0; i < rowToLetter.size(); ++i)
+		result.surprisals[i].second = rowToLetter[i]->surprise;
 
     return result;
 }
@@ -451,6 +1007,29 @@ std::vector<QCATRecord> QCAT::topNMostSurprising(int n, bool includeColumns) con
 		return std::vector<QCATRecord>();
 	}
 
+	if(!m_resultCaching)
+		return computeTopNMostSurprising(n, includeColumns);
+
+	auto cache = m_db->resultCache();
+	const std::string version = cache->version(m_db.get());
+	const std::string key = resultCacheKey("topn|" + boost::lexical_cast<std::string>(n) + (includeColumns ? "|cols" : ""));
+
+	std::vector<QCATRecord> cached;
+	if(!version.empty() && cache->getRecords(key, version, &cached))
+		return cached;
+
+	bool success;
+	auto results = computeTopNMostSurprising(n, includeColumns, &success);
+	if(!version.empty() && success)
+		cache->putRecords(key, version, results);
+	return results;
+}
+
+std::vector<QCATRecord> QCAT::computeTopNMostSurprising(int n, bool includeColumns, bool* success) const
+{
+	if(success) *success = false;
+	stage();
+
     std::vector<QCATRecord> results;
 
     // set up our alphabet hashtable
@@ -461,7 +1040,10 @@ std::vector<QCATRecord> QCAT::topNMostSurprising(int n, bool includeColumns) con
     // execute QCAT
     const std::string sql = this->sql();
 
-    QCATDBResult rows = m_db->executeSQL(sql);
+	bool ok;
+    QCATDBResult rows = m_db->executeSQL(sql, &ok, m_control.get());
+	if(!queryCompleted(ok))
+		return results;
     int totalRows;
 
     // add QCAT results to hashtable
@@ -493,6 +1075,7 @@ std::vector<QCATRecord> QCAT::topNMostSurprising(int n, bool includeColumns) con
 
 	std::sort(results.begin(), results.end(), surprisal_sorter);
 
+	if(success) *success = true;
     return std::vector<QCATRecord>(results.rbegin(),results.rbegin()+std::min(n,(int)results.size()));
 }
 
@@ -501,6 +1084,7 @@ QCATExplanation QCAT::rowsMatchingCondition(std::string conditions) const
 {
     if(!this->userCanRun()) return QCATExplanation(this->whyCantUserRun()); 
 
+	stage();
 	QCATSummary summary = serverRun();
 
 	/*
@@ -516,7 +1100,7 @@ QCATExplanation QCAT::rowsMatchingCondition(std::string conditions) const
     // execute QCAT
     const std::string sql = "SELECT * FROM ( " + this->sql() + ") a WHERE " + conditions;
 
-    QCATDBResult rows = m_db->executeSQL(sql);
+    QCATDBResult rows = m_db->executeSQL(sql, NULL, m_control.get());
 
     // add QCAT results to hashtable
     for(int i = 0; i < rows->nrows(); ++i) {
@@ -573,12 +1157,18 @@ shared_ptr<QCATAttribute> QCAT::attributeForName(std::string name) const
 
 std::string QCAT::sql(std::vector<std::string> additionalSelects, bool where) const
 {
+	return sqlFrom(stagedTable(), additionalSelects, where);
+}
+
+std::string QCAT::sqlFrom(const std::string& staged, std::vector<std::string> additionalSelects, bool where) const
+{
+	// staged rows already satisfy the conditionals
 	// TODO, ugly hack selecting id explicitly
 	std::string sql = "SELECT id, " + sqlVONS() + " , " + sqlVONSHashSelect() + commaSepList(additionalSelects,true) +
-		" FROM " + m_db->tableSafe();
+		" FROM " + (staged.empty() ? m_db->tableSafe() : staged);
 
 	if(where)
-		sql += " WHERE " + sqlConditionals();
+		sql += " WHERE " + (staged.empty() ? sqlConditionals() : std::string(" TRUE "));
 	
 	sql+= sqlLimit();
 	return sql;
@@ -633,16 +1223,19 @@ std::string QCAT::sqlVONSHash(bool withAS) const
 
 std::string QCAT::sqlConditionals() const
 {
-    std::string str = "";
+	return sqlConditionals(std::set<std::string>());
+}
 
-    if(m_conditionals.size() == 0)
-        return " TRUE ";
+std::string QCAT::sqlConditionals(const std::set<std::string>& except) const
+{
+    std::string str = "";
 
     for(auto c: m_conditionals) {
-        str += c.second->sql() + " AND ";
+		if(except.find(c.first) == except.end())
+	        str += c.second->sql() + " AND ";
     }
 
-    return str.empty() ? "" : str.substr(0, str.size() - 5);
+    return str.empty() ? " TRUE " : str.substr(0, str.size() - 5);
 }
 
 std::string QCAT::sqlLimit() const
@@ -654,11 +1247,44 @@ std::string QCAT::sqlLimit() const
 }
 
 std::string QCAT::sqlServerTableName() const
+{
+	std::string conditions;
+	return sqlServerTableName(&conditions);
+}
+
+std::string QCAT::sqlServerTableName(std::string* conditions) const
+{
+	const std::string staged = stagedTable();
+	*conditions = staged.empty() ? sqlConditionals() : " TRUE ";
+	return sqlLimitedTable(staged.empty() ? m_db->tableSafe() : staged);
+}
+
+std::string QCAT::sqlLimitedTable(const std::string& table) const
 {
 	if(m_limit == -1)
-		return m_db->tableSafe();
+		return table;
 	else
-		return "(SELECT * FROM " + m_db->tableSafe() + " LIMIT " + boost::lexical_cast<std::string>(m_limit) + ") _sstn";
+		return "(SELECT * FROM " + table + " LIMIT " + boost::lexical_cast<std::string>(m_limit) + ") _sstn";
+}
+
+void QCAT::stage() const
+{
+	// a LIMIT picks different rows from the staging table than from the table itself, so don't stage limited QCATs
+	m_stagedTable.clear();
+	m_stagedConditions.clear();
+	if(m_staging == fsm_none || m_conditionals.empty() || m_limit != -1)
+		return;
+
+	m_stagedConditions = sqlConditionals();
+	m_stagedTable = m_db->stagingTable(m_stagedConditions, m_staging == fsm_unlogged);
+}
+
+std::string QCAT::stagedTable() const
+{
+	// the conditionals may have changed since the last run staged them
+	if(m_stagedTable.empty() || m_limit != -1 || m_stagedConditions != sqlConditionals())
+		return "";
+	return m_stagedTable;
 }
 
 void QCAT::clearConditions()
@@ -817,6 +1443,50 @@ int QCAT::limit() const
 	return m_limit;
 }
 
+void QCAT::setResultCaching(bool enabled)
+{
+	m_resultCaching = enabled;
+}
+
+bool QCAT::resultCaching() const
+{
+	return m_resultCaching;
+}
+
+void QCAT::setProfiling(bool enabled)
+{
+	m_profiling = enabled;
+}
+
+bool QCAT::profiling() const
+{
+	return m_profiling;
+}
+
+shared_ptr<QCATPlan> QCAT::profile(const std::string& sql) const
+{
+	bool success;
+	QCATDBResult rows = m_db->executeSQL(QCATPlan::explainSQL(sql), &success, m_control.get());
+	if(!success || rows->nrows() < 1) {
+		std::cerr << "*** QCAT::profile could not EXPLAIN the QCAT's SQL" << std::endl;
+		return shared_ptr<QCATPlan>();
+	}
+
+	// FORMAT JSON returns the whole plan in a single value
+	auto plan = make_shared<QCATPlan>(QCATPlan::fromJSON(rows->get(0, 0), &success));
+	return success ? plan : shared_ptr<QCATPlan>();
+}
+
+void QCAT::setStaging(QCATStagingMethod method)
+{
+	m_staging = method;
+}
+
+QCATStagingMethod QCAT::staging() const
+{
+	return m_staging;
+}
+
 void QCAT::setExecutionMethod(QCATExecutionMethod method)
 {
 	m_executionMethod = method;
@@ -4,6 +4,7 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <algorithm>
 #include <unordered_map>
 #include <boost/lexical_cast.hpp>
 
@@ -11,20 +12,33 @@
 #include <iostream>
 #include <memory>
 #include <new>
+#include <future>
 
 using namespace std;
 
 //#include "libpq-fe.h" 
 #include "qcatcondition.h"
 #include "qcatfield.h"
+#include "qcatcounttable.h"
+#include "qcatbinstats.h"
+#include "qcattimings.h"
+#include "qcatplan.h"
 
 class QCAT;
+class QCATLattice;
+class QCATQueryControl;
 
 enum QCATExecutionMethod {
 	fem_client = 0,
 	fem_server = 1
 };
 
+enum QCATStagingMethod {
+	fsm_none = 0,
+	fsm_temp = 1,
+	fsm_unlogged = 2
+};
+
 /*!
  * \brief A letter in the alphabet Z
  */
@@ -105,6 +119,16 @@ public:
     std::string message;
     float wall_time;
 
+	/*!
+	 * \brief Per-phase breakdown of wall_time
+	 */
+	QCATQueryTimings timings;
+
+	/*!
+	 * \brief The executed plan of sql_used when the QCAT was run with profiling on, otherwise NULL
+	 */
+	shared_ptr<QCATPlan> plan;
+
 	bool success;
 
 //	unordered_map<std::string,std::string> attrs;
@@ -120,6 +144,7 @@ public:
 
     void init() {
         wall_time = 0;
+		timings.init();
         entropy = 0;
         surprise_mean = 0;
         surprise_stddev = 0;
@@ -225,6 +250,48 @@ public:
 	std::vector<std::pair<std::string,double>> surprisals;
 };
 
+/*!
+ * \brief Information-theoretic breakdown of a QCAT's VONs. Everything is marginalised from one count table
+ * over the joint VON values, so no further queries are needed for any subset.
+ */
+struct QCATInformation
+{
+	QCATSummary summary;
+	map<std::string,double> marginal_entropy;		// H(VON_i)
+	map<std::string,double> conditional_entropy;	// H(VON_i | all other VONs)
+	QCATCountTable counts;
+
+	/*!
+	 * \brief Joint entropy H(A) of a subset of VONs
+	 */
+	double entropy(std::vector<std::string> a) const {
+		return counts.entropy(a);
+	}
+
+	/*!
+	 * \brief Conditional entropy H(A | B) = H(A,B) - H(B)
+	 */
+	double conditionalEntropy(std::vector<std::string> a, std::vector<std::string> b) const {
+		return entropy(joined(a, b)) - entropy(b);
+	}
+
+	/*!
+	 * \brief Mutual information I(A; B) = H(A) + H(B) - H(A,B) between two subsets of VONs
+	 */
+	double mutualInformation(std::vector<std::string> a, std::vector<std::string> b) const {
+		return entropy(a) + entropy(b) - entropy(joined(a, b));
+	}
+
+private:
+	static std::vector<std::string> joined(std::vector<std::string> a, const std::vector<std::string>& b) {
+		for(auto item: b) {
+			if(std::find(a.begin(), a.end(), item) == a.end())
+				a.push_back(item);
+		}
+		return a;
+	}
+};
+
 enum QCATHashType {
     fht_string_concat = 0,
     fht_int_1 = 1,				// 1 byte integer
@@ -345,6 +412,13 @@ public:
 	 */
 	shared_ptr<QCATBinStrategy> binStrategy() const;
 
+	/*!
+	 * \brief Materialises the binned values of all attributes at their current widths, so sql() reads stored
+	 * columns instead of computing bins per row (see QCATDataSource::materialiseBinColumn).
+	 * \param asIndexes If true, creates expression indexes on the bin expressions instead of columns
+	 */
+	void materialiseBins(bool asIndexes = false);
+
     /*!
      * \brief Run this QCAT in its current state
      * \return
@@ -377,6 +451,89 @@ public:
 	 */
 	QCATSummaryAndSurprisals summaryAndSurprisals() const;
 
+	/*!
+	 * \brief Runs execute() on another thread. The QCAT is copied, so later changes to this one don't affect
+	 * the run. Queries on one data source are serialised, so use a data source per concurrent QCAT.
+	 * \param control Optional control for cancelling the run or bounding each query's time; a stopped run
+	 * returns an unsuccessful summary
+	 */
+	std::future<QCATSummary> executeAsync(shared_ptr<QCATQueryControl> control = shared_ptr<QCATQueryControl>()) const;
+
+	/*!
+	 * \brief Runs explain() on another thread (see executeAsync)
+	 */
+	std::future<QCATExplanation> explainAsync(int topn = 100, bool includeColumns = true, 
+			shared_ptr<QCATQueryControl> control = shared_ptr<QCATQueryControl>()) const;
+
+	/*!
+	 * \brief Runs topNMostSurprising() on another thread (see executeAsync); a stopped run returns no records
+	 */
+	std::future<std::vector<QCATRecord> > topNMostSurprisingAsync(int n = 100, bool includeColumns = true, 
+			shared_ptr<QCATQueryControl> control = shared_ptr<QCATQueryControl>()) const;
+
+	/*!
+	 * \brief Runs summaryAndSurprisals() on another thread (see executeAsync)
+	 */
+	std::future<QCATSummaryAndSurprisals> summaryAndSurprisalsAsync(shared_ptr<QCATQueryControl> control = shared_ptr<QCATQueryControl>()) const;
+
+	/*!
+	 * \brief Evaluates this QCAT for a ladder of bin widths in a single scan. Rows are counted once at the current
+	 * (finest) widths, and the letters for each coarser width are derived by merging bins on the client.
+	 * Fixed-width bins are floored (floor(x / width)) so that merging is exact; this can differ from the
+	 * rounding CAST used by execute() for values near bin edges.
+	 * \param multipliers Width multipliers; each quantitative VON is binned at its current width times the
+	 * multiplier. Defaults to powers of two from 1 to 64.
+	 * \return Map of multiplier to summary
+	 */
+	std::map<int,QCATSummary> binWidthSweep(std::vector<int> multipliers = std::vector<int>()) const;
+
+	/*!
+	 * \brief Evaluates this QCAT for every (binned) value of a conditional with a single GROUP BY query, rather than
+	 * fixing the conditional and executing once per value. Any other conditionals still apply.
+	 * \param conditional Name of the field to sweep; uses the bin of the existing conditional if there is one
+	 * \return Map of the conditional's binned value to summary (empty if the QCAT can't run)
+	 */
+	std::map<std::string,QCATSummary> conditionalSweep(std::string conditional) const;
+
+	/*!
+	 * \brief Evaluates this QCAT for every subset of the given conditionals and every combination of their (binned)
+	 * values with a single GROUP BY CUBE query. Conditionals outside the cube still apply as fixed, and must be;
+	 * those in the cube may be left unfixed.
+	 * \param conditionals Conditionals forming the cube; defaults to the spec's unfixed conditionals, or all of
+	 * its conditionals if every one is fixed
+	 * \return Lattice of summaries, rooted at the QCAT with none of the cube conditionals applied
+	 */
+	QCATLattice cube(std::vector<std::string> conditionals = std::vector<std::string>()) const;
+
+	/*!
+	 * \brief Fills a heatmap of the entropy (or uncertainty) of every pair of the given fields taken as VONs, under
+	 * the current conditionals. Each field and each pair is counted by one grouping set of a single query.
+	 * \param fields Fields to pair; each uses its bin in this QCAT if it has one, else its default bin
+	 * \param uncertainty If true, fills uncertainty rather than entropy
+	 * \return Heatmap with a row-major fields x fields matrix; the diagonal holds each field on its own
+	 */
+	QCATSummaryHeatmap summaryHeatmap(std::vector<std::string> fields, bool uncertainty = false) const;
+
+	/*!
+	 * \brief Bin histograms of every VON, built with a single scan (see QCATBinStats::compileMany)
+	 * \return Map of VON name to its histogram
+	 */
+	std::map<std::string,QCATBinStats> vonHistograms() const;
+
+	/*!
+	 * \brief Runs this QCAT and additionally reports per-VON marginal entropies, conditional entropies
+	 * H(VON_i | rest) and a count table for mutual information between VON subsets, all from one query
+	 */
+	QCATInformation information() const;
+
+	/*!
+	 * \brief Counts rows over the joint binned values of the given fields under the current conditionals (one GROUP BY query)
+	 * \param pairwise Only count each field and each pair of fields (one GROUP BY GROUPING SETS query), so the
+	 * result grows with the pairs' cardinalities rather than the joint one; the table then only answers
+	 * marginals over one or two fields
+	 */
+	QCATCountTable countTable(std::vector<std::string> fields, bool* success = NULL, bool pairwise = false) const;
+
     /*!
      * \brief Provides a nice readable description of this QCAT
      */
@@ -397,15 +554,16 @@ public:
     /*!
      * \brief isComplete
      * \param why Pointer to string that we put error/success message into 
+     * \param unfixed Conditionals that may be left unfixed (e.g. the dimensions of a cube)
      * \return true if the QCAT is complete enough to run
      */
-    bool isComplete(std::string* why = NULL) const;
+    bool isComplete(std::string* why = NULL, const std::set<std::string>& unfixed = std::set<std::string>()) const;
 
 	/*!
 	 * \brief userCanRun
 	 * \param similar to isComplete but prints error
 	 */
-	bool userCanRun() const;
+	bool userCanRun(const std::set<std::string>& unfixed = std::set<std::string>()) const;
 	std::string whyCantUserRun() const;
 
     bool hasAttrAsCondition(shared_ptr<QCATField> name) const;
@@ -439,6 +597,31 @@ public:
 	void setExecutionMethod(QCATExecutionMethod);
 	QCATExecutionMethod executionMethod() const;
 
+	/*!
+	 * \brief Reuse summaries, top-N and surprisal results from the data source's result cache while the
+	 * table is unchanged (off by default)
+	 */
+	void setResultCaching(bool enabled);
+	bool resultCaching() const;
+
+	/*!
+	 * \brief After each successful execute() or summaryAndSurprisals(), run its SQL again under
+	 * EXPLAIN (ANALYZE, BUFFERS) and attach the plan to the summary (off by default). This runs
+	 * the query twice. For server runs the plan is of the rows the server function reads (the
+	 * conditioned SELECT it is given), since the function call itself can't be seen into.
+	 */
+	void setProfiling(bool enabled);
+	bool profiling() const;
+
+	/*!
+	 * \brief Copy the rows matching the conditionals into a staging table (see QCATDataSource::stagingTable)
+	 * the first time they are needed, and run later QCATs with the same conditionals against it. VONs and
+	 * bins can change freely between runs. Off (fsm_none) by default; has no effect without conditionals
+	 * or with a limit (see setLimit()), since a limit would take different rows from the staged copy.
+	 */
+	void setStaging(QCATStagingMethod method);
+	QCATStagingMethod staging() const;
+
 	void setServerSP(std::string name, std::string args);
 	std::string serverSPName() const;
 	std::string serverSPArgs() const;
@@ -450,6 +633,7 @@ public:
     std::string sqlVONSHashSelect() const;
     std::string sqlVONSHashGroupBy() const;
     std::string sqlConditionals() const;
+    std::string sqlConditionals(const std::set<std::string>& except) const;
 	std::string sqlLimit() const;
 	std::string sqlServerTableName() const;
 
@@ -458,23 +642,69 @@ private:
 	void init();
 	void initialiseBinsFromStrategy(bool override_existing);
 
+	shared_ptr<QCATAttribute> conditionalAttribute(std::string name) const;
+
     static std::string escapeQuotes(std::string);
     std::vector<std::string> ensureNoVONClash(std::vector<std::string>) const;
 
+	/*!
+	 * \brief Fills entropy, surprise and uncertainty from the counts of each letter in Z
+	 */
+	static QCATSummary summaryFromCounts(const std::vector<double>& counts, std::vector<double>* surprisals = NULL);
+
+	/*!
+	 * \brief summaryFromCounts() over a letter table, also storing each letter's probability and surprise
+	 */
+	static QCATSummary summaryFromLetters(std::unordered_map<std::string,QCATLetter>& Z);
+
     QCATSummary clientRun() const;
     QCATSummary clientRunSSE() const;
     QCATSummary serverRun() const;
 	QCATSummary run() const;
+	QCATSummaryAndSurprisals computeSummaryAndSurprisals() const;
+	std::vector<QCATRecord> computeTopNMostSurprising(int n, bool includeColumns, bool* success = NULL) const;
+
+	/*!
+	 * \brief True if a query succeeded and wasn't cancelled or timed out; only then may its result be cached
+	 */
+	bool queryCompleted(bool success) const;
+	QCATSummary queryFailureSummary(const std::string& sql) const;
+	std::string resultCacheKey(std::string kind) const;
+	static void markIfStopped(QCATSummary& summary, const QCATQueryControl* control);
+	shared_ptr<QCATPlan> profile(const std::string& sql) const;
+
+	/*!
+	 * \brief Resolves the staging table for the current conditionals, creating or rebuilding it as needed.
+	 * Called once at the start of each run, so that generating SQL never touches the database.
+	 */
+	void stage() const;
+
+	/*!
+	 * \brief The staging table resolved by the last stage() if it still matches the conditionals, else empty
+	 */
+	std::string stagedTable() const;
+
+	/*!
+	 * \brief The relation to read rows from, with the LIMIT applied, and the conditions still to apply to it
+	 */
+	std::string sqlServerTableName(std::string* conditions) const;
+	std::string sqlLimitedTable(const std::string& table) const;
+	std::string sqlFrom(const std::string& staged, std::vector<std::string> additionalSelects, bool where) const;
 
     std::map<std::string, shared_ptr<QCATCondition> > m_conditionals;
     std::map<std::string, shared_ptr<QCATAttribute> > m_vons;
 
 	int m_limit;
+	bool m_resultCaching;
+	bool m_profiling;
+	QCATStagingMethod m_staging;
+	mutable std::string m_stagedTable, m_stagedConditions;
 	QCATExecutionMethod m_executionMethod;
 	shared_ptr<QCATBinStrategy> m_binStrategy;
 	std::string m_serverSPName, m_serverSPArgs;
 
     shared_ptr<QCATDataSource> m_db;
+	shared_ptr<QCATQueryControl> m_control;
     QCATSpec m_spec;
     QCATHashType m_hashType;
 };
@@ -7,8 +7,7 @@
 #include "qcatfieldstats.h"
 #include "qcatbinstats.h"
 
-#define BOOST_LOG_DYN_LINK 1
-#include <boost/log/trivial.hpp>
+#include "qcatlog.h"
 
 QCATAttribute::QCATAttribute(shared_ptr<QCATField> field)
 {
@@ -51,25 +50,26 @@ void QCATAttribute::setDefaultBin()
 			m_bin = unique_ptr<QCATBin>(new QCATBinDouble()); break;
 		case fft_date:
 		case fft_time:
-			m_bin = unique_ptr<QCATBin>(new QCATBinTimestamp()); break;
+			m_bin = unique_ptr<QCATBin>(new QCATBinTimestamp(!m_field->db() || m_field->db()->serverVersion() >= 140000)); break;
 		default:
 			m_bin = unique_ptr<QCATBin>(new QCATBinPassthrough(m_field->type()));
 	}
 
-	BOOST_LOG_TRIVIAL(info) << "Set default bin of type " << m_bin->unit() 
+	QCAT_LOG(qll_trace) << "Set default bin of type " << m_bin->unit() 
 		<< " for attribute " << m_field->name() << " and isPassthrough: " 
-		<< m_bin->isPassthrough() << std::endl;
+		<< m_bin->isPassthrough();
 }
 
 void QCATAttribute::applyBinStrategy()
 {
-	m_bin->setBinWidth(m_binStrategy->width(this));
+	m_binStrategy->apply(std::vector<QCATAttribute*>(1, this));
 }
 
-void QCATAttribute::setBinStrategy(shared_ptr<QCATBinStrategy> bs)
+void QCATAttribute::setBinStrategy(shared_ptr<QCATBinStrategy> bs, bool apply)
 {
 	m_binStrategy = bs;
-	applyBinStrategy();
+	if(apply && m_binStrategy)
+		applyBinStrategy();
 }
 
 shared_ptr<QCATBinStrategy> QCATAttribute::binStrategy() const
@@ -79,7 +79,12 @@ shared_ptr<QCATBinStrategy> QCATAttribute::binStrategy() const
 
 bool QCATAttribute::hasBinStrategy() const
 {
-   return m_binStrategy == make_shared<QCATBinStrategy>();
+   return (bool)m_binStrategy;
+}
+
+std::string QCATAttribute::safePad(std::string str)
+{
+    return " " + str + " ";
 }
 
 std::string QCATAttribute::sqlSelect() const
@@ -109,7 +114,10 @@ std::string QCATAttribute::sqlUnbinned() const
 
 std::string QCATAttribute::sql(bool withAS) const
 {
-    return m_bin->sqlAttrToBin(m_field->name()) + (withAS ? m_field->name() : "");
+	// read a materialised bin column instead of recomputing the expression, if one is known
+	const std::string expr = m_bin->sqlAttrToBin(m_field->name());
+	const std::string cached = m_bin->isPassthrough() ? "" : m_field->db()->binCacheColumnFor(expr);
+    return (cached.empty() ? expr : safePad(cached)) + (withAS ? m_field->name() : "");
 }
 
 std::string QCATAttribute::sqlBinExpr(std::string str, std::string AS) const
@@ -127,28 +135,24 @@ std::string QCATAttribute::sqlForVal(std::string value) const
     return m_bin->sqlValToBin(value);
 }
 
-/*void QCATAttribute::ensureBinCacheColumn() const
+std::string QCATAttribute::binCacheColumnName() const
 {
-    if(m_bin->isPassthrough())
-        return;
-
-    try {
-        std::string sqlCreate = "ALTER TABLE " + m_db->table() + " ADD COLUMN " + binCacheColumnName() + " smallint";
-        bool success;
-        QCATDBResult result = m_db->executeSQL(sqlCreate,&success);
+	return m_field->binCacheColumnName(m_bin->sqlAttrToBin(m_field->name()));
+}
 
-        if(success) {
-#ifdef QCAT_VERBOSE
-            BOOST_LOG_TRIVIAL(info) << "Creating bin cache " << binCacheColumnName() << std::endl;
-#endif
-            // if executing the above doesn't throw, then we can go ahead and fill the new column in
-            std::string sqlFill = "UPDATE " + m_db->table() + " SET " + binCacheColumnName() + " = " + sqlBinExpr(name());
-            m_db->executeSQL(sqlFill);
-        }
-    }
-    catch(exception e) {
+bool QCATAttribute::ensureBinCacheColumn()
+{
+	if(m_bin->isPassthrough())
+		return false;
 
-    }
-}*/
+	return m_field->db()->materialiseBinColumn(m_field->name(), binCacheColumnName(), m_bin->sqlAttrToBin(m_field->name()));
+}
 
+bool QCATAttribute::ensureBinIndex()
+{
+	if(m_bin->isPassthrough())
+		return false;
 
+	const std::string expr = m_bin->sqlAttrToBin(m_field->name());
+	return m_field->db()->createBinIndex(m_field->name(), m_field->indexName(expr), expr);
+}
@@ -19,11 +19,16 @@ public:
 	QCATAttribute(shared_ptr<QCATField>);
 
 	bool hasBinStrategy() const;
-	void setBinStrategy(shared_ptr<QCATBinStrategy>);
+	/*!
+	 * \brief Sets the bin strategy for this attribute
+	 * \param apply If false, only records the strategy (the caller applies it, e.g. in a batch across attributes)
+	 */
+	void setBinStrategy(shared_ptr<QCATBinStrategy>, bool apply = true);
 	shared_ptr<QCATBinStrategy> binStrategy() const;
 
 	shared_ptr<QCATField> field() const { return m_field; }
 	shared_ptr<QCATBin> bin() const { return m_bin; }
+	void setBin(shared_ptr<QCATBin> bin) { m_bin = bin; }
 	std::string name() const { return m_field->name(); }
 	QCATDataSource* const db() { return m_field->db(); }
 
@@ -84,6 +89,20 @@ public:
 
 	bool OK() const;
 
+	/*!
+	 * \brief Materialises this attribute's binned values (at the current bin width) into a generated column of
+	 * the table and records it in the bin cache catalog. Queries then read the column instead of computing the bin.
+	 * \return True if the column exists
+	 */
+	bool ensureBinCacheColumn();
+
+	/*!
+	 * \brief Creates an expression index on this attribute's bin expression (kept up to date by Postgres)
+	 */
+	bool ensureBinIndex();
+
+	std::string binCacheColumnName() const;
+
 
 private:
 	void applyBinStrategy();
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
+#include <stddef.h>
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -52,6 +54,36 @@ public:
 	 */
 	virtual std::string sqlValToBasicUnit(std::string val) const = 0;
 
+	/*!
+	 * \brief Generates SQL giving an attribute as an unbinned double precision value in this bin's basic unit,
+	 * such that the fixed-width bin is that value divided by the width
+	 * \return SQL string, or empty if this bin isn't fixed-width
+	 */
+	virtual std::string sqlAttrToUnits(std::string /*attr*/) const {
+		return "";
+	}
+
+	/*!
+	 * \brief Generates a predicate on the raw attribute that holds for every row whose bin lies in [binlo, binhi].
+	 * It may also admit rows from neighbouring bins, so callers keep the binned predicate as a recheck; its
+	 * purpose is to let Postgres use an ordinary index on the attribute.
+	 * \param binlo SQL for the lowest bin
+	 * \param binhi SQL for the highest bin
+	 * \return SQL string, or empty if this bin type can't provide one
+	 */
+	virtual std::string sqlAttrInBinRange(std::string /*attr*/, std::string /*binlo*/, std::string /*binhi*/) const {
+		return "";
+	}
+
+	/*!
+	 * \brief Bins raw values on the client, giving the same bin numbers as sqlAttrToBin() does on the server.
+	 * The loops are branch-free so they vectorise; use this to fetch a column once and rebin it at many widths.
+	 * \param in Raw values (numbers as they are; timestamps as seconds since the epoch)
+	 * \param n Number of values
+	 * \param out Receives n bin numbers
+	 */
+	virtual void bin(const double* in, size_t n, int32_t* out) const = 0;
+
     /*!
      * \brief Is this just a passthrough bin? (I.E. just the attribute itself)
      */
@@ -1,5 +1,7 @@
 #include "qcatbinnumeric.h"
 #include <boost/lexical_cast.hpp>
+#include <type_traits>
+#include <math.h>
 
 template class QCATBinNumeric<int>;
 template class QCATBinNumeric<double>;
@@ -38,3 +40,42 @@ std::string QCATBinNumeric<T>::sqlValToBasicUnit(std::string val) const
 {
 	return sqlFieldToBasicUnit(val); 
 }
+
+template<class T>
+std::string QCATBinNumeric<T>::sqlAttrToUnits(std::string attr) const
+{
+	return safePad("CAST(" + attr + " AS double precision)");
+}
+
+template<class T>
+std::string QCATBinNumeric<T>::sqlAttrInBinRange(std::string attr, std::string binlo, std::string binhi) const
+{
+	if(binWidth() <= 0)
+		return "";
+
+	// whether the cast truncates or rounds, bin k always lies within ((k-1)*w, (k+1)*w)
+	const std::string w = boost::lexical_cast<std::string>(binWidth());
+	return safePad(attr + " > ((" + binlo + ") - 1) * " + w + " AND " + attr + " < ((" + binhi + ") + 1) * " + w);
+}
+
+template<class T>
+void QCATBinNumeric<T>::bin(const double* in, size_t n, int32_t* out) const
+{
+	const double w = binWidth();
+
+	if(std::is_integral<T>::value && w == floor(w)) {
+		// int / int; exact in double for 32 bit values, and the cast truncates like integer division
+		for(size_t i = 0; i < n; ++i)
+			out[i] = (int32_t)(in[i] / w);
+	}
+	else if(std::is_integral<T>::value) {
+		// int / numeric gives numeric, which rounds half away from zero when cast
+		for(size_t i = 0; i < n; ++i)
+			out[i] = (int32_t)round(in[i] / w);
+	}
+	else {
+		// double precision casts round half to even
+		for(size_t i = 0; i < n; ++i)
+			out[i] = (int32_t)nearbyint(in[i] / w);
+	}
+}
@@ -17,6 +17,15 @@ public:
 	std::string sqlBinToVal(std::string binval) const;
 	std::string sqlFieldToBasicUnit(std::string field) const;
 	std::string sqlValToBasicUnit(std::string field) const;
+	std::string sqlAttrToUnits(std::string attr) const;
+	std::string sqlAttrInBinRange(std::string attr, std::string binlo, std::string binhi) const;
+
+	/*!
+	 * \brief Integer columns divided by an integral width use integer division in SQL, so truncate; any other
+	 * division is done in numeric or double precision and the cast to int rounds (half away from zero for
+	 * numeric, half to even for double precision)
+	 */
+	void bin(const double* in, size_t n, int32_t* out) const;
 	bool isQuantitative() const { return true; } 
 
     virtual std::vector<QCATBinSuggestion> suggestions() const {
@@ -1,4 +1,5 @@
 #include "qcatbinpassthrough.h"
+#include <algorithm>
 
 std::string QCATBinPassthrough::sqlAttrToBin(std::string str) const
 {
@@ -24,3 +25,25 @@ std::string QCATBinPassthrough::sqlValToBasicUnit(std::string val) const
 {
 	return sqlFieldToBasicUnit(val); 
 }
+
+void QCATBinPassthrough::bin(const double* in, size_t n, int32_t* out) const
+{
+	if(m_fieldType != fft_integer && m_fieldType != fft_boolean) {
+		std::cerr << "*** QCATBinPassthrough::bin: only integer fields can be binned natively" << std::endl;
+		std::fill(out, out + n, -1);
+		return;
+	}
+
+	for(size_t i = 0; i < n; ++i)
+		out[i] = (int32_t)in[i];
+}
+
+void QCATBinPassthrough::bin(const std::string* in, size_t n, int32_t* out, std::unordered_map<std::string,int32_t>* dictionary) const
+{
+	for(size_t i = 0; i < n; ++i) {
+		auto it = dictionary->find(in[i]);
+		if(it == dictionary->end())
+			it = dictionary->insert(std::make_pair(in[i], (int32_t)dictionary->size())).first;
+		out[i] = it->second;
+	}
+}
@@ -1,6 +1,8 @@
 #ifndef FACASFIELDBINPASSTHROUGH_H
 #define FACASFIELDBINPASSTHROUGH_H
 
+#include <iostream>
+#include <unordered_map>
 #include "qcatfield.h"
 #include "qcatbin.h"
 
@@ -30,6 +32,20 @@ public:
 	std::string sqlValToBasicUnit(std::string field) const;
 	bool isQuantitative() const { return false; } 
 
+	/*!
+	 * \brief Integers (and booleans, as 0 or 1) bin to themselves. Only integer fields bin natively: any other
+	 * value would be truncated into another letter, so for other types this reports an error and gives bin -1
+	 * throughout; bin strings with the dictionary form instead.
+	 */
+	void bin(const double* in, size_t n, int32_t* out) const;
+
+	/*!
+	 * \brief Strings bin to codes from a dictionary, assigned in order of first appearance. Equal strings
+	 * share a code, so the letters formed are the same as on the server, though the values differ.
+	 * \param dictionary Codes assigned so far; reuse it to keep codes stable across calls
+	 */
+	void bin(const std::string* in, size_t n, int32_t* out, std::unordered_map<std::string,int32_t>* dictionary) const;
+
     virtual std::vector<QCATBinSuggestion> suggestions() const {
         return boost::assign::list_of<QCATBinSuggestion>
             (QCATBinSuggestion("<identity>",1));
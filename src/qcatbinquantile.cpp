@@ -0,0 +1,67 @@
+#include "qcatbinquantile.h"
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+QCATBinQuantile::QCATBinQuantile(QCATFieldType type, std::vector<double> boundaries)
+	:QCATBin("bucket","buckets"), m_fieldType(type), m_boundaries(boundaries)
+{
+	// skewed columns repeat quantiles; duplicate boundaries only make empty buckets
+	std::sort(m_boundaries.begin(), m_boundaries.end());
+	m_boundaries.erase(std::unique(m_boundaries.begin(), m_boundaries.end()), m_boundaries.end());
+}
+
+std::string QCATBinQuantile::sqlValueExpr(std::string attr, QCATFieldType type)
+{
+	if(type == fft_date || type == fft_time)
+		return "extract(epoch from " + attr + ")::double precision";
+	return "CAST(" + attr + " AS double precision)";
+}
+
+std::string QCATBinQuantile::sqlBoundaries() const
+{
+	std::string str = "ARRAY[";
+	for(auto b: m_boundaries)
+		str += boost::lexical_cast<std::string>(b) + ",";
+	if(!m_boundaries.empty())
+		str = str.substr(0, str.size()-1);
+	return str + "]::double precision[]";
+}
+
+std::string QCATBinQuantile::sqlAttrToBin(std::string str) const
+{
+	return safePad("width_bucket(" + sqlValueExpr(str, m_fieldType) + ", " + sqlBoundaries() + ")");
+}
+
+std::string QCATBinQuantile::sqlValToBin(std::string val) const
+{
+	return safePad("width_bucket(" + sqlValToBasicUnit(val) + ", " + sqlBoundaries() + ")");
+}
+
+std::string QCATBinQuantile::sqlBinToVal(std::string val) const
+{
+	// lower boundary of the bucket (bucket 0 has none)
+	return safePad("(" + sqlBoundaries() + ")[" + val + "]");
+}
+
+std::string QCATBinQuantile::sqlFieldToBasicUnit(std::string field) const
+{
+	return safePad(sqlValueExpr(field, m_fieldType));
+}
+
+std::string QCATBinQuantile::sqlValToBasicUnit(std::string val) const
+{
+	if(m_fieldType == fft_date || m_fieldType == fft_time)
+		return sqlFieldToBasicUnit("(to_timestamp('" + val + "','YYYY-MM-DD HH24:MI:SS'))");
+	return sqlFieldToBasicUnit(val);
+}
+
+int QCATBinQuantile::bin(double value) const
+{
+	return std::upper_bound(m_boundaries.begin(), m_boundaries.end(), value) - m_boundaries.begin();
+}
+
+void QCATBinQuantile::bin(const double* in, size_t n, int32_t* out) const
+{
+	for(size_t i = 0; i < n; ++i)
+		out[i] = bin(in[i]);
+}
@@ -0,0 +1,54 @@
+#ifndef QCATBINQUANTILE_H
+#define QCATBINQUANTILE_H
+
+#include "qcatfield.h"
+#include "qcatbin.h"
+
+/*!
+ * \brief An equi-depth bin: values are mapped to the bucket between consecutive boundaries (usually
+ * quantiles of the attribute) rather than divided by a fixed width. Binning is done with width_bucket()
+ * on the server or a binary search on the client; both give identical bucket numbers.
+ */
+class QCATBinQuantile : public QCATBin
+{
+public:
+    QCATBinQuantile(QCATFieldType type, std::vector<double> boundaries);
+
+    std::string sqlAttrToBin(std::string attr) const;
+    std::string sqlValToBin(std::string val) const;
+	std::string sqlBinToVal(std::string binval) const;
+	std::string sqlFieldToBasicUnit(std::string field) const;
+	std::string sqlValToBasicUnit(std::string field) const;
+	bool isQuantitative() const { return true; } 
+
+    virtual std::vector<QCATBinSuggestion> suggestions() const {
+        return boost::assign::list_of<QCATBinSuggestion>
+            (QCATBinSuggestion("<quantiles>",1));
+    }
+
+    std::string currentBinDescription() const {
+        return boost::lexical_cast<std::string>(m_boundaries.size() + 1) + " " + unitPlural();
+    }
+
+	/*!
+	 * \brief Client-side equivalent of width_bucket(value, boundaries)
+	 * \param value Value in this bin's basic unit (seconds since epoch for timestamps)
+	 */
+	int bin(double value) const;
+	void bin(const double* in, size_t n, int32_t* out) const;
+
+	const std::vector<double>& boundaries() const { return m_boundaries; }
+
+	/*!
+	 * \brief SQL giving an attribute as a double precision value in the unit the boundaries are expressed in
+	 */
+	static std::string sqlValueExpr(std::string attr, QCATFieldType type);
+
+private:
+	std::string sqlBoundaries() const;
+
+    QCATFieldType m_fieldType;
+	std::vector<double> m_boundaries;
+};
+
+#endif // QCATBINQUANTILE_H
@@ -3,51 +3,84 @@
 #include "qcatattribute.h"
 #include "qcatbin.h"
 #include "qcatdatasource.h"
+#include <boost/lexical_cast.hpp>
 
 QCATBinStats::QCATBinStats(const QCATAttribute* attr)
 {
     compile(attr);
 }
 
+std::vector<shared_ptr<QCATBinSummary> > QCATBinStats::bins() const
+{
+	std::vector<shared_ptr<QCATBinSummary> > bins;
+	for(auto& b: m_bins)
+		bins.push_back(shared_ptr<QCATBinSummary>(new QCATBinSummary(b)));
+	return bins;
+}
+
 void QCATBinStats::compile(const QCATAttribute* attr)
 {
-	auto db = attr->field()->db();
-	auto bin = attr->bin();
-	auto field = attr->field();
-
-    m_bins.clear();
-
-    std::string sql = "SELECT cnt, x1, x2 FROM ( SELECT MIN(" + attr->name() + ") as x1, MAX(" + attr->name() + ") as x2, COUNT(id) AS cnt, " + bin->sqlAttrToBin(field->name()) +
-            "AS bin FROM " + db->table() + " GROUP BY "+ bin->sqlAttrToBin(field->name()) +
-            ") a ORDER BY bin";
-
-    auto result = db->executeSQL(sql);
-    bool numeric = field->type() == fft_integer || field->type() == fft_double;
-
-    double total = 0;
-    int nonNumericCounter = 0;
-    for(int i=0;i<result->nrows();i++) {
-        double cnt = result->getDouble(i,"cnt");
-        double x1,x2;
-        if(numeric) {
-			x1 = result->getDouble(i,"x1");
-			x2 = result->getDouble(i,"x2");
-        }
-        else {
-            x1 = nonNumericCounter++;
-            x2 = nonNumericCounter++;
-        }
-
-        auto b = shared_ptr<QCATBinSummary>(new QCATBinSummary());
-        b->prob = cnt;
-        b->x1 = x1;
-        b->x2 = x2;
-        b->cnt = cnt;
-        total += cnt;
-        m_bins.push_back(b);
-    }
-
-    for(auto item: m_bins) {
-        item->prob /= total;
-    }
+	*this = compileMany(std::vector<const QCATAttribute*>(1, attr)).front();
+}
+
+std::vector<QCATBinStats> QCATBinStats::compileMany(const std::vector<const QCATAttribute*>& attrs)
+{
+	std::vector<QCATBinStats> stats(attrs.size());
+	if(attrs.empty())
+		return stats;
+
+	auto db = attrs.front()->field()->db();
+
+	// one grouping set per attribute; GROUPING(b<i>) = 0 marks the rows of attribute i
+	std::string inner, selects, sets, order;
+	std::vector<bool> numeric(attrs.size());
+	for(size_t i = 0; i < attrs.size(); ++i) {
+		auto field = attrs[i]->field();
+		const std::string n = boost::lexical_cast<std::string>(i);
+		numeric[i] = field->type() == fft_integer || field->type() == fft_double;
+
+		inner += attrs[i]->bin()->sqlAttrToBin(field->name()) + " AS b" + n + ", ";
+		if(numeric[i]) {
+			inner += attrs[i]->name() + " AS a" + n + ", ";
+			selects += "MIN(a" + n + ") AS x1_" + n + ", MAX(a" + n + ") AS x2_" + n + ", ";
+		}
+		selects += "GROUPING(b" + n + ") AS g" + n + ", ";
+		sets += std::string(i ? "," : "") + "(b" + n + ")";
+		order += std::string(i ? "," : "") + "b" + n + " NULLS LAST";
+	}
+
+	std::string sql = "SELECT " + selects + "COUNT(id) AS cnt FROM ( SELECT " + inner + "id FROM " + db->table() + 
+		") a GROUP BY GROUPING SETS (" + sets + ") ORDER BY " + order;
+
+	auto result = db->executeSQL(sql);
+
+	std::vector<double> totals(attrs.size(), 0);
+	std::vector<int> nonNumericCounters(attrs.size(), 0);
+	for(int r = 0; r < result->nrows(); r++) {
+		size_t i = 0;
+		while(i < attrs.size() && result->getInt(r, "g" + boost::lexical_cast<std::string>(i)) != 0)
+			++i;
+		if(i == attrs.size())
+			continue;
+
+		const std::string n = boost::lexical_cast<std::string>(i);
+		QCATBinSummary b;
+		b.cnt = b.prob = result->getDouble(r, "cnt");
+		if(numeric[i]) {
+			b.x1 = result->getDouble(r, "x1_" + n);
+			b.x2 = result->getDouble(r, "x2_" + n);
+		}
+		else {
+			b.x1 = nonNumericCounters[i]++;
+			b.x2 = nonNumericCounters[i]++;
+		}
+		totals[i] += b.cnt;
+		stats[i].m_bins.push_back(b);
+	}
+
+	for(size_t i = 0; i < attrs.size(); ++i) {
+		for(auto& b: stats[i].m_bins)
+			b.prob /= totals[i];
+	}
+	return stats;
 }
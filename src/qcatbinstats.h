@@ -23,11 +23,25 @@ public:
     QCATBinStats() {}
     QCATBinStats(const QCATAttribute*);
 
-    std::vector<shared_ptr<QCATBinSummary> > bins() { return m_bins; }
+	/*!
+	 * \brief Histograms for many attributes of one data source from a single scan (GROUPING SETS, one set per attribute)
+	 * \return One QCATBinStats per attribute, in the same order
+	 */
+	static std::vector<QCATBinStats> compileMany(const std::vector<const QCATAttribute*>& attrs);
+
+	/*!
+	 * \brief The bins, in bin order, stored contiguously
+	 */
+	const std::vector<QCATBinSummary>& summaries() const { return m_bins; }
+
+	/*!
+	 * \brief Copies of the bins as individually allocated summaries (prefer summaries())
+	 */
+    std::vector<shared_ptr<QCATBinSummary> > bins() const;
 
 private:
     void compile(const QCATAttribute*);
-    std::vector<shared_ptr<QCATBinSummary> > m_bins;
+    std::vector<QCATBinSummary> m_bins;
 };
 
 #endif // FACASBINSTATS_H
@@ -3,6 +3,9 @@
 #include "qcatfieldstats.h"
 #include "qcatattribute.h"
 #include "qcatbin.h"
+#include "qcatbinquantile.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 QCATBinStrategy::QCATBinStrategy() 
 {
@@ -14,15 +17,67 @@ double QCATBinStrategyExact::width(QCATAttribute* attr) const
 	return m_width;
 }
 
+std::vector<double> QCATBinStrategy::widths(const std::vector<QCATAttribute*>& attrs) const
+{
+	if(!attrs.empty()) {
+		std::vector<QCATField*> fields;
+		for(auto attr: attrs)
+			fields.push_back(attr->field().get());
+		attrs.front()->db()->prefetchFieldStats(fields);
+	}
+
+	std::vector<double> result;
+	for(auto attr: attrs)
+		result.push_back(width(attr));
+	return result;
+}
+
+void QCATBinStrategy::apply(const std::vector<QCATAttribute*>& attrs) const
+{
+	// fixed width strategies need the attribute's usual bin back if an equi-depth one was applied before
+	for(auto attr: attrs) {
+		if(dynamic_pointer_cast<QCATBinQuantile>(attr->bin()))
+			attr->setDefaultBin();
+	}
+
+	auto w = widths(attrs);
+	for(size_t i = 0; i < attrs.size(); ++i)
+		attrs[i]->bin()->setBinWidth(w[i]);
+}
+
+bool QCATBinStrategy::statsRange(QCATAttribute* attr, double* range)
+{
+	auto fs = attr->field()->stats();
+	if(fs.min().reliable_numeric && fs.max().reliable_numeric) {
+		*range = fs.range();
+		return true;
+	}
+
+	// timestamps are stored as text; timestamp bins work in minutes
+	if(attr->field()->type() == fft_date || attr->field()->type() == fft_time) {
+		try {
+			auto lo = boost::posix_time::time_from_string(fs.min().text.substr(0,19));
+			auto hi = boost::posix_time::time_from_string(fs.max().text.substr(0,19));
+			*range = (hi - lo).total_seconds() / 60.0;
+			return true;
+		}
+		catch(std::exception& e) {
+		}
+	}
+
+	std::cerr << "*** QCATBinStrategy: no usable range in stats for " << attr->name() << std::endl;
+	return false;
+}
+
 double QCATBinStrategyDivide::width(QCATAttribute* attr) const
 {
 	if(!attr->bin()->isQuantitative())
 		return 1.0;
 
-	auto fs = attr->field()->stats();
-	auto rangeSQL = "(" + fs.max().text + " - " + fs.min().text + ")"; 
-	auto divSQL = rangeSQL + " / " +  boost::lexical_cast<std::string>(m_by);
-	return boost::lexical_cast<double>(attr->db()->executeSQLSingleShot(divSQL, false));
+	double range;
+	if(!statsRange(attr, &range))
+		return attr->bin()->binWidth();
+	return range / m_by;
 }
 
 double QCATBinStrategyDivideIfMore::width(QCATAttribute* attr) const
@@ -30,13 +85,59 @@ double QCATBinStrategyDivideIfMore::width(QCATAttribute* attr) const
 	if(!attr->bin()->isQuantitative())
 		return 1.0;
 
-	auto fs = attr->field()->stats();
-	auto rangeSQL = "(" + fs.max().text + " - " + fs.min().text + ")"; 
-	auto divSQL = "(" + rangeSQL + " / " +  boost::lexical_cast<std::string>(m_by) + ")";
-	auto caseSQL = "(CASE WHEN " + rangeSQL + " >= "
-		+ boost::lexical_cast<std::string>(m_moreThanWhat)
-		+ " THEN " + divSQL 
-		+ " ELSE " + boost::lexical_cast<std::string>(attr->bin()->binWidth()) + " END)";
-	return boost::lexical_cast<double>(attr->db()->executeSQLSingleShot(caseSQL, false));
+	double range;
+	if(!statsRange(attr, &range))
+		return attr->bin()->binWidth();
+	return range >= m_moreThanWhat ? range / m_by : attr->bin()->binWidth();
 }
 
+void QCATBinStrategyEquiDepth::apply(const std::vector<QCATAttribute*>& attrs) const
+{
+	std::vector<QCATAttribute*> targets;
+	for(auto attr: attrs) {
+		if(attr->bin()->isQuantitative())
+			targets.push_back(attr);
+	}
+	if(targets.empty() || m_buckets < 2)
+		return;
+
+	std::string fractions = "ARRAY[";
+	for(int i = 1; i < m_buckets; ++i)
+		fractions += boost::lexical_cast<std::string>(i / (double)m_buckets) + ",";
+	fractions = fractions.substr(0, fractions.size()-1) + "]::double precision[]";
+
+	// one pass over the table gives the boundaries of every attribute
+	std::string sql = "SELECT ";
+	for(size_t i = 0; i < targets.size(); ++i) {
+		auto field = targets[i]->field();
+		sql += "percentile_disc(" + fractions + ") WITHIN GROUP (ORDER BY " 
+			+ QCATBinQuantile::sqlValueExpr(field->name(), field->type()) + ") AS _q" 
+			+ boost::lexical_cast<std::string>(i) + ",";
+	}
+	sql = sql.substr(0, sql.size()-1) + " FROM " + targets.front()->db()->tableSafe();
+
+	bool success;
+	auto rows = targets.front()->db()->executeSQL(sql, &success);
+	if(!success || !rows->hasRows()) {
+		std::cerr << "*** QCATBinStrategyEquiDepth: unable to compute quantiles" << std::endl;
+		return;
+	}
+
+	for(size_t i = 0; i < targets.size(); ++i) {
+		// arrays come back as {a,b,c}
+		std::string arr = rows->get(0, i);
+		boost::trim_if(arr, boost::is_any_of("{}"));
+		std::vector<std::string> parts;
+		boost::split(parts, arr, boost::is_any_of(","));
+
+		std::vector<double> boundaries;
+		for(auto part: parts) {
+			try {
+				boundaries.push_back(boost::lexical_cast<double>(part));
+			}
+			catch(boost::bad_lexical_cast& e) {
+			}
+		}
+		targets[i]->setBin(make_shared<QCATBinQuantile>(targets[i]->field()->type(), boundaries));
+	}
+}
@@ -22,6 +22,25 @@ public:
 	 * \return SQL-compatible string representing bin width
 	 */
 	virtual double width(QCATAttribute* field) const { return 1.0; };
+
+	/*!
+	 * \brief Resolves bin widths for many attributes at once. Field stats for all attributes are fetched
+	 * in one batch beforehand, so subclasses computing widths from stats make no further round trips.
+	 * \return Width for each attribute, in the same order
+	 */
+	virtual std::vector<double> widths(const std::vector<QCATAttribute*>& attrs) const;
+
+	/*!
+	 * \brief Applies this strategy to the bins of all given attributes
+	 */
+	virtual void apply(const std::vector<QCATAttribute*>& attrs) const;
+
+protected:
+	/*!
+	 * \brief The range (max - min) of an attribute in its bin's basic unit (number, minute), computed natively from its field stats
+	 * \return False if the stats don't give a usable range
+	 */
+	static bool statsRange(QCATAttribute* attr, double* range);
 };
 
 /*!
@@ -66,6 +85,20 @@ protected:
 	int m_width;
 };
 
+/*!
+ * \brief Equi-depth binning: each quantitative attribute is split into buckets holding roughly equal numbers
+ * of rows, with boundaries taken from percentile_disc. Boundaries for all attributes come from one scan.
+ */
+class QCATBinStrategyEquiDepth: public QCATBinStrategy
+{
+public:
+	QCATBinStrategyEquiDepth(int buckets)
+		:m_buckets(buckets) {}
+	virtual void apply(const std::vector<QCATAttribute*>& attrs) const;
+
+protected:
+	int m_buckets;
+};
 
 #endif // QCATFIELDBINSTRATEGY_H
 
@@ -1,5 +1,6 @@
 #include "qcatbintimestamp.h"
 #include <boost/lexical_cast.hpp>
+#include <math.h>
 
 const int removeSeconds = 250100000;
 
@@ -31,3 +32,34 @@ std::string QCATBinTimestamp::sqlValToBasicUnit(std::string val) const
 {
 	return sqlFieldToBasicUnit("'" + val + "'");
 }
+
+std::string QCATBinTimestamp::sqlAttrToUnits(std::string str) const
+{
+    return safePad("((extract(epoch from " + str + ") - " + boost::lexical_cast<std::string>(removeSeconds) + ") / 60.0)");
+}
+
+std::string QCATBinTimestamp::sqlAttrInBinRange(std::string attr, std::string binlo, std::string binhi) const
+{
+	if(binWidth() <= 0)
+		return "";
+
+	// bin k lies within ((k-1)*w, (k+1)*w) minutes after removeSeconds; a day of slack covers columns with time zones
+	const std::string w = boost::lexical_cast<std::string>(binWidth());
+	const std::string rs = boost::lexical_cast<std::string>(removeSeconds);
+	return safePad(attr + " > TIMESTAMP 'epoch' + (" + rs + " + ((" + binlo + ") - 1) * " + w + " * 60) * INTERVAL '1 second' - INTERVAL '1 day'"
+		+ " AND " + attr + " < TIMESTAMP 'epoch' + (" + rs + " + ((" + binhi + ") + 1) * " + w + " * 60) * INTERVAL '1 second' + INTERVAL '1 day'");
+}
+
+void QCATBinTimestamp::bin(const double* in, size_t n, int32_t* out) const
+{
+	const double w = binWidth();
+	if(m_numericEpoch) {
+		for(size_t i = 0; i < n; ++i)
+			out[i] = (int32_t)round(((in[i] - removeSeconds) / 60.0) / w);
+	}
+	else {
+		// the same double arithmetic as the server, then its rint() (the default rounding mode, half to even)
+		for(size_t i = 0; i < n; ++i)
+			out[i] = (int32_t)nearbyint(((in[i] - removeSeconds) / 60.0) / w);
+	}
+}
@@ -6,8 +6,12 @@
 class QCATBinTimestamp : public QCATBin
 {
 public:
-    QCATBinTimestamp()
-        :QCATBin("minute","minutes") {
+	/*!
+	 * \param numericEpoch Whether the server's extract(epoch) is numeric (Postgres 14+) rather than double
+	 * precision; this decides how bin() rounds ties, so it must match the server the SQL runs on
+	 */
+    QCATBinTimestamp(bool numericEpoch = true)
+        :QCATBin("minute","minutes"), m_numericEpoch(numericEpoch) {
         m_width = 15;
     }
 
@@ -16,6 +20,17 @@ public:
 	std::string sqlBinToVal(std::string binval) const;
 	std::string sqlFieldToBasicUnit(std::string field) const;
 	std::string sqlValToBasicUnit(std::string field) const;
+	std::string sqlAttrToUnits(std::string attr) const;
+	std::string sqlAttrInBinRange(std::string attr, std::string binlo, std::string binhi) const;
+
+	/*!
+	 * \brief Matches the server's cast to int: from Postgres 14 extract(epoch) is numeric, which rounds half
+	 * away from zero; before that it is double precision, which rounds half to even
+	 */
+	void bin(const double* in, size_t n, int32_t* out) const;
+
+	void setNumericEpoch(bool numeric) { m_numericEpoch = numeric; }
+	bool numericEpoch() const { return m_numericEpoch; }
 	bool isQuantitative() const { return true; } 
 
     virtual std::vector<QCATBinSuggestion> suggestions() const {
@@ -34,6 +49,9 @@ public:
     std::string currentBinDescription() const {
         return QCATBin::currentBinDescription(); // TODO: date formatting
     }
+
+private:
+	bool m_numericEpoch;
 };
 
 #endif // FACASFIELDBINTIMESTAMP_H
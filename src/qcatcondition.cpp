@@ -1,4 +1,5 @@
 #include "qcatcondition.h"
+#include "qcatbin.h"
 #include <iostream>
 
 QCATCondition::QCATCondition(shared_ptr<QCATAttribute> lhs)
@@ -85,6 +86,22 @@ QCATOp QCATCondition::op() const
 }
 
 std::string QCATCondition::sql()
+{
+	std::string str = sqlBinned();
+
+	// comparing bins can't use an index on the raw column, so prefix a raw range that can
+	if(m_op == fop_equal || m_op == fop_between) {
+		const std::string lo = m_lhs->sqlBinForValue(m_rhs_constant_a);
+		const std::string hi = m_op == fop_between ? m_lhs->sqlBinForValue(m_rhs_constant_b) : lo;
+		const std::string range = m_lhs->bin()->sqlAttrInBinRange(m_lhs->sqlUnbinned(), lo, hi);
+		if(!range.empty())
+			str = "(" + range + " AND " + str + ")";
+	}
+
+    return pad(str);
+}
+
+std::string QCATCondition::sqlBinned() const
 {
     // TODO For the time being, having a field as RHS is unsupported
     if(m_rhs_is_field) {
@@ -119,5 +136,5 @@ std::string QCATCondition::strForOp(QCATOp op)
 
 std::string QCATCondition::toString()
 {
-    return this->sql();
+    return this->sqlBinned();
 }
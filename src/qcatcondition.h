@@ -49,11 +49,17 @@ public:
     bool isComplete() const;
 
     /*!
-     * \brief Provides valid SQL snippet for this condition
+     * \brief Provides valid SQL snippet for this condition. Conditions on quantitative bins are prefixed with
+     * an equivalent range on the raw column so Postgres can use an index on it.
      * \return Conditional string; i.e. a < b
      */
     std::string sql();
 
+    /*!
+     * \brief The condition as a plain comparison of bins, without the raw column range
+     */
+    std::string sqlBinned() const;
+
     /*!
      * \brief Provides a readable description of this condition
      */
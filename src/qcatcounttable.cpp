@@ -0,0 +1,137 @@
+#include "qcatcounttable.h"
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+
+QCATCountTable::QCATCountTable(std::vector<std::string> columns)
+	:m_columns(columns), m_codes(columns.size()), m_values(columns.size()), m_total(0)
+{
+}
+
+int QCATCountTable::columnIndex(std::string name) const
+{
+	for(size_t i = 0; i < m_columns.size(); ++i) {
+		if(m_columns[i] == name)
+			return i;
+	}
+	return -1;
+}
+
+int QCATCountTable::code(int col, const std::string& value)
+{
+	auto it = m_codes[col].find(value);
+	if(it != m_codes[col].end())
+		return it->second;
+
+	const int c = m_values[col].size();
+	m_codes[col][value] = c;
+	m_values[col].push_back(value);
+	return c;
+}
+
+void QCATCountTable::add(const std::vector<std::string>& values, double count)
+{
+	std::vector<int> codes(m_columns.size());
+	for(size_t i = 0; i < m_columns.size(); ++i)
+		codes[i] = code(i, values[i]);
+	m_rows.push_back(codes);
+	m_counts.push_back(count);
+	m_total += count;
+}
+
+void QCATCountTable::addMarginal(std::vector<int> cols, const std::vector<std::string>& values, double count)
+{
+	for(size_t j = 0; j < cols.size(); ++j)
+		code(cols[j], values[j]);
+
+	std::sort(cols.begin(), cols.end());
+	m_marginals[cols].push_back(count);
+
+	// every marginal sums to the same total, so count just one of them
+	if(m_rows.empty()) {
+		if(m_totalCols.empty())
+			m_totalCols = cols;
+		if(cols == m_totalCols)
+			m_total += count;
+	}
+}
+
+std::vector<int> QCATCountTable::indices(const std::vector<std::string>& cols) const
+{
+	std::vector<int> result;
+	for(auto c: cols) {
+		const int idx = columnIndex(c);
+		if(idx == -1)
+			std::cerr << "*** QCATCountTable: no column " << c << std::endl;
+		else
+			result.push_back(idx);
+	}
+	return result;
+}
+
+std::vector<double> QCATCountTable::marginalCounts(const std::vector<int>& cols) const
+{
+	std::vector<int> sorted(cols);
+	std::sort(sorted.begin(), sorted.end());
+	auto stored = m_marginals.find(sorted);
+	if(stored != m_marginals.end())
+		return stored->second;
+	if(m_rows.empty() && !m_marginals.empty())
+		std::cerr << "*** QCATCountTable: marginal not held by this table" << std::endl;
+
+	// joint letters as mixed radix keys over the column cardinalities
+	bool fits = true;
+	double radix = 1;
+	for(auto c: cols) {
+		radix *= m_values[c].size();
+		fits = fits && radix < 9.0e18;
+	}
+
+	std::vector<double> result;
+	if(fits) {
+		std::unordered_map<unsigned long long,double> Z;
+		for(size_t r = 0; r < m_rows.size(); ++r) {
+			unsigned long long key = 0;
+			for(auto c: cols)
+				key = key * m_values[c].size() + m_rows[r][c];
+			Z[key] += m_counts[r];
+		}
+		for(auto& item: Z)
+			result.push_back(item.second);
+	}
+	else {
+		std::map<std::vector<int>,double> Z;
+		std::vector<int> key(cols.size());
+		for(size_t r = 0; r < m_rows.size(); ++r) {
+			for(size_t j = 0; j < cols.size(); ++j)
+				key[j] = m_rows[r][cols[j]];
+			Z[key] += m_counts[r];
+		}
+		for(auto& item: Z)
+			result.push_back(item.second);
+	}
+	return result;
+}
+
+double QCATCountTable::entropy(const std::vector<int>& cols) const
+{
+	if(cols.empty() || m_total <= 0)
+		return 0;
+
+	return entropy(marginalCounts(cols), m_total);
+}
+
+double QCATCountTable::entropy(const std::vector<double>& counts, double total)
+{
+	double HZ = 0;
+	for(auto c: counts) {
+		const double prob = c / total;
+		HZ += prob * log2(prob);
+	}
+	return -HZ;
+}
+
+double QCATCountTable::entropy(const std::vector<std::string>& cols) const
+{
+	return entropy(indices(cols));
+}
@@ -0,0 +1,76 @@
+#ifndef QCATCOUNTTABLE_H
+#define QCATCOUNTTABLE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+/*!
+ * \brief A table of row counts over the joint values of several columns (e.g. binned fields). Each value is
+ * dictionary encoded per column, so entropies of any subset of columns can be computed by marginalising the
+ * table rather than re-querying the database.
+ */
+class QCATCountTable
+{
+public:
+	QCATCountTable()
+		:m_total(0) {}
+	QCATCountTable(std::vector<std::string> columns);
+
+	/*!
+	 * \brief Adds count rows with the given joint values (one per column)
+	 */
+	void add(const std::vector<std::string>& values, double count);
+
+	/*!
+	 * \brief Adds the count of one letter of a marginal over a subset of the columns, e.g. from a grouping
+	 * set. Marginals added this way answer marginalCounts() for exactly that subset without needing rows.
+	 * \param values The letter's value in each of cols
+	 */
+	void addMarginal(std::vector<int> cols, const std::vector<std::string>& values, double count);
+
+	std::vector<std::string> columns() const { return m_columns; }
+	int columnIndex(std::string name) const;
+
+	/*!
+	 * \return The distinct values seen in a column, indexed by code
+	 */
+	const std::vector<std::string>& values(int col) const { return m_values[col]; }
+
+	/*!
+	 * \brief Total count over all rows
+	 */
+	double total() const { return m_total; }
+
+	/*!
+	 * \brief Counts of each joint letter of the given columns, marginalising over all others
+	 */
+	std::vector<double> marginalCounts(const std::vector<int>& cols) const;
+
+	/*!
+	 * \brief Entropy H of the joint letter of the given columns (empty gives 0)
+	 */
+	double entropy(const std::vector<int>& cols) const;
+	double entropy(const std::vector<std::string>& cols) const;
+
+	/*!
+	 * \brief Entropy of a set of letter counts
+	 */
+	static double entropy(const std::vector<double>& counts, double total);
+
+private:
+	std::vector<int> indices(const std::vector<std::string>& cols) const;
+	int code(int col, const std::string& value);
+
+	std::vector<std::string> m_columns;
+	std::vector<std::unordered_map<std::string,int> > m_codes;
+	std::vector<std::vector<std::string> > m_values;
+	std::vector<std::vector<int> > m_rows;		// codes per column, one entry per row
+	std::vector<double> m_counts;
+	std::map<std::vector<int>,std::vector<double> > m_marginals;	// letter counts keyed by sorted columns
+	std::vector<int> m_totalCols;		// the marginal the total is taken from when there are no rows
+	double m_total;
+};
+
+#endif // QCATCOUNTTABLE_H
@@ -1,31 +1,30 @@
 #include "qcatdatasource.h"
+#include "qcatresultcache.h"
+#include "qcatwarmcache.h"
+#include "qcatlog.h"
 #include <iostream>
 #include <boost/lexical_cast.hpp>
-#include <boost/thread/mutex.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/functional/hash.hpp>
+#include <chrono>
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <sys/select.h>
+#include <errno.h>
 #define LIMITING_CONDITION " TRUE "
-#define LOG_SQL 
+#define CONTROL_POLL_USEC 50000
+#define PIPELINE_MAX_QUERIES 128
+#define STAGING_PREFIX "qcat_stage_"
 
-#ifdef LOG_SQL
-#define BOOST_LOG_DYN_LINK 1
-#include <boost/log/trivial.hpp>
-#include <boost/log/utility/setup/file.hpp>
-namespace logging = boost::log;
-#endif
-
-boost::mutex db_mutex;
-
-// we want to replace the default postgres notice handler to redirect to the log if necessary
+// we want to replace the default postgres notice handler to redirect to the log
 static void CC_handle_notice(void *arg, const char *msg) 
 { 
-	#ifdef LOG_SQL
-		BOOST_LOG_TRIVIAL(info) << std::string(msg) << std::endl;
-	#else
-		std::cout << msg << std::endl;
-	#endif
+	QCAT_LOG(qll_info) << boost::algorithm::trim_right_copy(std::string(msg));
 }
 
-QCATDataSource::QCATDataSource(std::string connStr, std::string table)
-    :m_table(table), m_goodConnection(false)
+QCATDataSource::QCATDataSource(std::string connStr, std::string table, std::string warmCacheDir)
+    :m_table(table), m_goodConnection(false), m_statTableEnsured(false), m_versionWarned(false), m_statsProvider(fsp_exact), m_statsFallbackToExact(false), m_resultCache(new QCATResultCache()), m_stagingCheckInterval(5)
 {
 	m_client = PQconnectdb(connStr.c_str());
 	if (PQstatus(m_client) == CONNECTION_BAD) {
@@ -34,18 +33,25 @@ QCATDataSource::QCATDataSource(std::string connStr, std::string table)
 		return;
 	}
 
-#ifdef LOG_SQL
-	logging::add_file_log(
-		logging::keywords::file_name = "libqcat.log",
-		logging::keywords::auto_flush = true,
-		logging::keywords::format = "[%TimeStamp%]: %Message%"
-		);
+	QCATLog::init();
 	PQsetNoticeProcessor(m_client, CC_handle_notice, NULL);
-#endif
 
-	m_fields = shared_ptr<QCATFieldManager>(new QCATFieldManager(this));
+	if(!warmCacheDir.empty()) {
+		m_warmCache = shared_ptr<QCATWarmCache>(new QCATWarmCache(warmCacheDir, connStr, table));
+		m_warmFingerprint = schemaFingerprint();
+		auto version = tableVersion();
+		m_warmVersion = version.valid ? version.token() : "";
+		m_fields = m_warmCache->restore(this, m_warmFingerprint, m_warmVersion);
+	}
+
+	const bool warm = (bool)m_fields;
+	if(!warm)
+		m_fields = shared_ptr<QCATFieldManager>(new QCATFieldManager(this));
 	m_goodConnection = m_fields->vector().size() != 0;	
 
+	if(m_goodConnection && !warm)
+		saveWarmCache();
+
 	if(!m_goodConnection) {
 		std::cerr << "*** QCATDataSource: Unable to obtain any fields from table " << table << std::endl;
 		return;
@@ -54,6 +60,9 @@ QCATDataSource::QCATDataSource(std::string connStr, std::string table)
 
 QCATDataSource::~QCATDataSource()
 {
+	if(m_goodConnection)
+		saveWarmCache();
+	dropStagingTables();
 	PQfinish(m_client);
 }
 
@@ -62,6 +71,45 @@ bool QCATDataSource::goodConnection() const
 	return m_goodConnection;
 }
 
+int QCATDataSource::serverVersion() const
+{
+	// cached by libpq at connection time, so this doesn't use the connection
+	return PQserverVersion(m_client);
+}
+
+void QCATDataSource::setStatsProvider(QCATFieldStatsProvider provider, bool fallbackToExact)
+{
+	m_statsProvider = provider;
+	m_statsFallbackToExact = fallbackToExact;
+}
+
+QCATFieldStatsProvider QCATDataSource::statsProvider() const
+{
+	return m_statsProvider;
+}
+
+std::string QCATDataSource::schemaFingerprint() const
+{
+	bool success;
+	auto rows = executeSQL("SELECT md5(c.oid::text || ':' || string_agg(a.attnum || ':' || a.attname || ':' || a.atttypid || ':' || a.atttypmod, ',' ORDER BY a.attnum)) "
+		"FROM pg_class c JOIN pg_attribute a ON a.attrelid = c.oid "
+		"WHERE c.oid = to_regclass('" + table() + "') AND a.attnum > 0 AND NOT a.attisdropped GROUP BY c.oid", &success);
+	if(!success || rows->nrows() == 0)
+		return "";
+	return rows->get(0,0);
+}
+
+void QCATDataSource::saveWarmCache() const
+{
+	if(m_warmCache && m_fields)
+		m_warmCache->save(m_fields.get(), m_warmFingerprint, m_warmVersion);
+}
+
+shared_ptr<QCATResultCache> QCATDataSource::resultCache() const
+{
+	return m_resultCache;
+}
+
 std::string QCATDataSource::table() const
 {
     return m_table;
@@ -92,35 +140,273 @@ std::string QCATDataSource::executeSQLSingleShot(std::string sql, bool wrap) con
 	}
 }
 
-QCATDBResult QCATDataSource::executeSQL(std::string sql, bool* success) const
+QCATQueryControl::QCATQueryControl(double timeoutSeconds)
+	:m_cancelled(false), m_timedOut(false), m_timeout(timeoutSeconds)
 {
-    boost::mutex::scoped_lock lock(db_mutex);
-	PGresult* r;
-    try {
-#ifdef LOG_SQL
-		BOOST_LOG_TRIVIAL(info) << "QCATDataSource::executeSQL running SQL:" << endl;
-		BOOST_LOG_TRIVIAL(info) << "\t" << sql << endl;
-#endif
-        r = PQexec(m_client, sql.c_str());
-		auto rs = PQresultStatus(r);
+}
 
-        if(success != NULL)
-            *success = rs == PGRES_TUPLES_OK 
-			   || rs == PGRES_EMPTY_QUERY
-			   || rs == PGRES_COMMAND_OK;
-    }
-    catch(exception e) {
-#ifdef LOG_SQL
-		BOOST_LOG_TRIVIAL(error) << "*******" << endl
-			<< "ERROR Failed to execute SQL: " << endl << sql << endl 
-			<< "*******" << endl;
-#endif
-        if(success != NULL)
-            *success = false;
-    }
+void QCATQueryControl::cancel()
+{
+	m_cancelled = true;
+}
+
+bool QCATQueryControl::cancelled() const
+{
+	return m_cancelled;
+}
+
+void QCATQueryControl::setTimeout(double seconds)
+{
+	m_timeout = seconds;
+}
+
+double QCATQueryControl::timeout() const
+{
+	return m_timeout;
+}
+
+bool QCATQueryControl::timedOut() const
+{
+	return m_timedOut;
+}
+
+void QCATQueryControl::setTimedOut()
+{
+	m_timedOut = true;
+}
+
+bool QCATQueryControl::stopped() const
+{
+	return m_cancelled || m_timedOut;
+}
+
+QCATDBResult QCATDataSource::executeSQL(std::string sql, bool* success, QCATQueryControl* control, QCATQueryTimings* timings) const
+{
+	QCAT_LOG(qll_debug) << "QCATDataSource::executeSQL running SQL:" << endl << "\t" << sql;
+
+	PGresult* r = NULL;
+	bool failed = false;
+	std::string error;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		try {
+			if(control || timings)
+				r = executeControlled(sql, control, timings);
+			else
+				r = PQexec(m_client, sql.c_str());
+			auto rs = PQresultStatus(r);
+			const bool ok = rs == PGRES_TUPLES_OK 
+				   || rs == PGRES_EMPTY_QUERY
+				   || rs == PGRES_COMMAND_OK;
+			if(!ok) {
+				error = r ? PQresultErrorMessage(r) : PQerrorMessage(m_client);
+				if(error.empty())
+					error = PQresStatus(rs);
+			}
+
+			if(success != NULL)
+				*success = ok;
+		}
+		catch(exception e) {
+			failed = true;
+			if(success != NULL)
+				*success = false;
+		}
+	}
+
+	if(failed)
+		QCAT_LOG(qll_error) << "Failed to execute SQL: " << endl << sql;
+	else if(!error.empty())
+		QCAT_LOG(qll_error) << "SQL failed: " << error << "\t" << sql;
     return shared_ptr<QCATPQResult>(new QCATPQResult(r));
 }
 
+static bool resultOK(PGresult* r)
+{
+	auto rs = PQresultStatus(r);
+	return rs == PGRES_TUPLES_OK || rs == PGRES_EMPTY_QUERY || rs == PGRES_COMMAND_OK;
+}
+
+std::vector<QCATDBResult> QCATDataSource::executeSQLBatch(const std::vector<std::string>& sql, std::vector<bool>* successes) const
+{
+	std::vector<QCATDBResult> results;
+	std::vector<bool> ok;
+	if(QCATLog::enabled(qll_debug)) {
+		QCATLogRecord record(qll_debug);
+		record.stream() << "QCATDataSource::executeSQLBatch running " << sql.size() << " statements:";
+		for(auto& s: sql)
+			record.stream() << endl << "\t" << s;
+	}
+
+	boost::mutex::scoped_lock lock(m_mutex);
+
+	size_t done = 0;
+	bool connectionLost = false;
+#ifdef LIBPQ_HAS_PIPELINING
+	// results for one statement, terminated by NULL, then its sync marker
+	auto readResult = [&]() {
+		PGresult* last = NULL;
+		PGresult* r;
+		while((r = PQgetResult(m_client)) != NULL) {
+			if(last)
+				PQclear(last);
+			last = r;
+		}
+		while((r = PQgetResult(m_client)) != NULL) {
+			const bool sync = PQresultStatus(r) == PGRES_PIPELINE_SYNC;
+			PQclear(r);
+			if(sync)
+				break;
+		}
+		ok.push_back(last && resultOK(last));
+		results.push_back(QCATDBResult(new QCATPQResult(last)));
+	};
+
+	// a sync after each statement keeps an error in one from aborting the rest; batches are bounded
+	// so the server never blocks on a full output buffer while we are still sending
+	while(done < sql.size() && PQenterPipelineMode(m_client)) {
+		const size_t end = std::min(sql.size(), done + PIPELINE_MAX_QUERIES);
+		size_t sent = done;
+		bool unsynced = false;
+		for( ; sent < end; ++sent) {
+			if(!PQsendQueryParams(m_client, sql[sent].c_str(), 0, NULL, NULL, NULL, NULL, 0))
+				break;
+			if(!PQpipelineSync(m_client)) {
+				// the statement is queued without its sync; retried once the earlier results are read
+				unsynced = true;
+				break;
+			}
+		}
+
+		for(size_t i = done; i < sent; ++i)
+			readResult();
+
+		if(unsynced) {
+			if(PQpipelineSync(m_client))
+				readResult();
+			else {
+				ok.push_back(false);
+				results.push_back(QCATDBResult(new QCATPQResult(NULL)));
+			}
+			++sent;
+		}
+		done = sent;
+
+		// still in pipeline mode, PQexec would fail every remaining statement and leave the connection unusable
+		if(!PQexitPipelineMode(m_client)) {
+			std::cerr << "*** QCATDataSource::executeSQLBatch unable to leave pipeline mode: " << PQerrorMessage(m_client) << std::endl;
+			connectionLost = true;
+			break;
+		}
+		if(sent < end)
+			break;
+	}
+#endif
+
+	if(connectionLost) {
+		for( ; done < sql.size(); ++done) {
+			ok.push_back(false);
+			results.push_back(QCATDBResult(new QCATPQResult(NULL)));
+		}
+	}
+
+	for( ; done < sql.size(); ++done) {
+		PGresult* r = PQexec(m_client, sql[done].c_str());
+		ok.push_back(resultOK(r));
+		results.push_back(QCATDBResult(new QCATPQResult(r)));
+	}
+
+	if(successes)
+		*successes = ok;
+	return results;
+}
+
+PGresult* QCATDataSource::executeControlled(const std::string& sql, QCATQueryControl* control, QCATQueryTimings* timings) const
+{
+	if(control && control->stopped())
+		return NULL;
+
+	if(!PQsendQuery(m_client, sql.c_str())) {
+		std::cerr << "*** QCATDataSource::executeSQL unable to send query: " << PQerrorMessage(m_client) << std::endl;
+		return NULL;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	auto firstData = start;
+	bool gotData = false;
+	const int sock = PQsocket(m_client);
+	bool cancelSent = false;
+
+	// wait on the socket in short slices so that cancellation and timeouts are noticed
+	while(PQisBusy(m_client)) {
+		if(control && !cancelSent && control->timeout() > 0) {
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			if(elapsed.count() > control->timeout())
+				control->setTimedOut();
+		}
+		if(control && !cancelSent && control->stopped()) {
+			cancelRunningQuery();
+			cancelSent = true;
+		}
+
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(sock, &fds);
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = CONTROL_POLL_USEC;
+
+		const int ready = select(sock + 1, &fds, NULL, NULL, &tv);
+		if(ready < 0 && errno != EINTR)
+			break;
+		if(ready > 0 && !gotData) {
+			firstData = std::chrono::steady_clock::now();
+			gotData = true;
+		}
+		if(!PQconsumeInput(m_client))
+			break;
+	}
+
+	// drain every result so the connection is ready for the next query; keep the last
+	PGresult* last = NULL;
+	PGresult* r;
+	while((r = PQgetResult(m_client)) != NULL) {
+		if(last)
+			PQclear(last);
+		last = r;
+	}
+
+	if(timings) {
+		const auto end = std::chrono::steady_clock::now();
+		if(!gotData)
+			firstData = end;
+		timings->server_execution += std::chrono::duration<double>(firstData - start).count();
+		timings->transfer += std::chrono::duration<double>(end - firstData).count();
+
+		if(last) {
+			const int nrows = PQntuples(last), ncols = PQnfields(last);
+			timings->rows += nrows;
+			for(int i = 0; i < nrows; ++i) {
+				for(int j = 0; j < ncols; ++j)
+					timings->bytes += PQgetlength(last, i, j);
+			}
+		}
+	}
+	return last;
+}
+
+void QCATDataSource::cancelRunningQuery() const
+{
+	PGcancel* cancel = PQgetCancel(m_client);
+	if(!cancel)
+		return;
+
+	char err[256];
+	if(!PQcancel(cancel, err, sizeof(err)))
+		std::cerr << "*** QCATDataSource: unable to cancel query: " << err << std::endl;
+	PQfreeCancel(cancel);
+}
+
 shared_ptr<QCATField> QCATDataSource::fieldForName(std::string name)
 {
     try {
@@ -139,18 +425,134 @@ shared_ptr<QCATFieldManager> QCATDataSource::fields() const
 
 std::vector<shared_ptr<QCATFieldStats> > QCATDataSource::fieldStats() const
 {
-	ensureFieldStatTable();
+	std::vector<QCATField*> fields;
+	for(auto field: m_fields->vector())
+		fields.push_back(field.get());
+	prefetchFieldStats(fields);
 
 	std::vector<shared_ptr<QCATFieldStats> > stats;
-	for(auto field: m_fields->vector()) {
-		stats.push_back(shared_ptr<QCATFieldStats>(new QCATFieldStats(field.get(), this)));
+	for(auto field: fields) {
+		stats.push_back(shared_ptr<QCATFieldStats>(new QCATFieldStats(field->stats())));
 	}
 	return stats;	
 }
 
+void QCATDataSource::prefetchFieldStats(std::vector<QCATField*> fields) const
+{
+	std::string names;
+	for(auto field: fields) {
+		if(!field->hasStats())
+			names += "'" + field->name() + "',";
+	}
+	if(names.empty())
+		return;
+
+	ensureFieldStatTable();
+	const QCATTableVersion version = tableVersion();
+
+	bool success;
+	auto rows = executeSQL("SELECT field, " + QCATFieldStats::sqlCacheColumns() + ", "
+		"extract(epoch from now() - last_compiled) / 86400 AS _age FROM " + table() + "_stats "
+		"WHERE field IN (" + names.substr(0, names.size()-1) + ")", &success);
+
+	// fresh rows are used as they are; rows with only appends since are merged from the new rows
+	std::vector<shared_ptr<QCATFieldStats> > appended;
+	for(int i = 0; success && i < rows->nrows(); i++) {
+		const QCATStatsCacheState state = QCATFieldStats::cacheState(rows, i, version);
+		if(state == scs_stale)
+			continue;
+		const std::string name = rows->get(i,"field");
+		for(auto field: fields) {
+			if(field->name() != name || field->hasStats())
+				continue;
+			auto stats = shared_ptr<QCATFieldStats>(new QCATFieldStats(field, rows, i));
+			if(state == scs_fresh)
+				field->setStats(stats);
+			else
+				appended.push_back(stats);
+		}
+	}
+
+	std::vector<std::string> saves;
+	if(!appended.empty()) {
+		std::vector<std::string> sql;
+		for(auto stats: appended)
+			sql.push_back(stats->sqlIncremental(this));
+
+		std::vector<bool> ok;
+		auto results = executeSQLBatch(sql, &ok);
+		for(size_t i = 0; i < appended.size(); ++i) {
+			if(!ok[i] || !appended[i]->mergeIncremental(results[i]))
+				continue;
+			appended[i]->setVersion(version);
+			appended[i]->field()->setStats(appended[i]);
+			auto q = appended[i]->sqlSaveToCache(appended[i]->field(), this);
+			saves.insert(saves.end(), q.begin(), q.end());
+		}
+	}
+
+	if(m_statsProvider == fsp_planner) {
+		std::vector<QCATField*> missing;
+		for(auto field: fields) {
+			if(!field->hasStats())
+				missing.push_back(field);
+		}
+
+		auto planner = missing.empty() ? QCATDBResult() : executeSQL(QCATFieldStats::sqlPlanner(missing, this), &success);
+		for(int i = 0; planner && success && i < planner->nrows(); i++) {
+			const std::string name = planner->get(i,"attname");
+			for(auto field: missing) {
+				if(field->name() == name && !field->hasStats())
+					field->setStats(QCATFieldStats::fromPlannerRow(field, planner, i));
+			}
+		}
+
+		if(!m_statsFallbackToExact) {
+			for(auto field: missing) {
+				if(!field->hasStats())
+					field->setStats(QCATFieldStats::unavailable(field));
+			}
+		}
+	}
+
+	// compile everything still missing in one pipelined batch, then save it all in another
+	std::vector<QCATField*> missing;
+	std::vector<std::string> sql;
+	std::vector<size_t> offsets;
+	for(auto field: fields) {
+		if(field->hasStats() || std::find(missing.begin(), missing.end(), field) != missing.end())
+			continue;
+		missing.push_back(field);
+		offsets.push_back(sql.size());
+		auto q = QCATFieldStats::sqlCompile(field, this);
+		sql.insert(sql.end(), q.begin(), q.end());
+	}
+	offsets.push_back(sql.size());
+
+	std::vector<bool> ok;
+	auto results = executeSQLBatch(sql, &ok);
+
+	for(size_t i = 0; i < missing.size(); ++i) {
+		std::vector<QCATDBResult> r(results.begin() + offsets[i], results.begin() + offsets[i+1]);
+		std::vector<bool> s(ok.begin() + offsets[i], ok.begin() + offsets[i+1]);
+		auto stats = shared_ptr<QCATFieldStats>(new QCATFieldStats(missing[i], r, s));
+		stats->setVersion(version);
+		missing[i]->setStats(stats);
+
+		auto q = stats->sqlSaveToCache(missing[i], this);
+		saves.insert(saves.end(), q.begin(), q.end());
+	}
+	executeSQLBatch(saves);
+}
+
 void QCATDataSource::ensureFieldStatTable() const
 {
-	std::string sql = "CREATE TABLE " + table() + "_stats ";
+	boost::mutex::scoped_lock lock(m_statTableMutex);
+	if(m_statTableEnsured)
+		return;
+	m_statTableEnsured = true;
+
+	std::string sql = "CREATE TABLE IF NOT EXISTS " + table() + "_stats ";
 	sql += "(  _unique double precision,	\
 		  special character varying,		\
 		  last_compiled date,				\
@@ -167,20 +569,267 @@ void QCATDataSource::ensureFieldStatTable() const
 		  OWNER TO postgres;		\
 		  ";
 	executeSQL(sql);
+
+	// change tracking columns, added separately so older stats tables pick them up
+	executeSQL("ALTER TABLE " + table() + "_stats "
+		"ADD COLUMN IF NOT EXISTS n_rows bigint, "
+		"ADD COLUMN IF NOT EXISTS sum double precision, "
+		"ADD COLUMN IF NOT EXISTS sum_sq double precision, "
+		"ADD COLUMN IF NOT EXISTS table_version character varying, "
+		"ADD COLUMN IF NOT EXISTS high_water bigint");
+}
+
+void QCATDataSource::ensureBinCacheCatalog() const
+{
+	executeSQL("CREATE TABLE IF NOT EXISTS " + table() + "_bincache "
+		"(  column_name character varying PRIMARY KEY,	\
+		  field character varying NOT NULL,		\
+		  bin_expr text NOT NULL,				\
+		  kind character varying NOT NULL,		\
+		  created timestamp DEFAULT now()		\
+		)");
+}
+
+std::string QCATDataSource::stagingTable(const std::string& conditions, bool unlogged) const
+{
+	boost::mutex::scoped_lock lock(m_stagingMutex);
+	const std::string key = std::string(unlogged ? "unlogged|" : "temp|") + conditions;
+	auto it = m_stagingTables.find(key);
+	if(it != m_stagingTables.end() && difftime(time(NULL), it->second.checkedAt) < m_stagingCheckInterval)
+		return it->second.name;
+
+	const QCATTableVersion v = tableVersion();
+	if(!v.valid)
+		return "";
+	const std::string version = v.token();
+
+	if(it != m_stagingTables.end()) {
+		if(it->second.version == version) {
+			it->second.checkedAt = time(NULL);
+			return it->second.name;
+		}
+		executeSQL("DROP TABLE IF EXISTS " + it->second.name);
+		m_stagingTables.erase(it);
+	}
+
+	// unlogged tables are visible to every session, so keep ours apart with the backend pid
+	std::stringstream name;
+	name << STAGING_PREFIX << PQbackendPID(m_client) << "_" << std::hex << boost::hash<std::string>()(key + "|" + version);
+
+	bool success;
+	executeSQL(std::string("CREATE ") + (unlogged ? "UNLOGGED" : "TEMP") + " TABLE " + name.str() 
+		+ " AS SELECT * FROM " + tableSafe() + " WHERE " + conditions, &success);
+	if(!success) {
+		std::cerr << "*** QCATDataSource::stagingTable: unable to create staging table for " << conditions << std::endl;
+		return "";
+	}
+	// the planner needs statistics on the new table to pick sensible plans over it
+	executeSQL("ANALYZE " + name.str());
+
+	QCAT_LOG(qll_debug) << "QCATDataSource::stagingTable created " << name.str() << " for " << conditions;
+	m_stagingTables[key] = StagingTable{name.str(), version, time(NULL)};
+	return name.str();
+}
+
+void QCATDataSource::setStagingCheckInterval(double seconds)
+{
+	boost::mutex::scoped_lock lock(m_stagingMutex);
+	m_stagingCheckInterval = seconds;
+}
+
+double QCATDataSource::stagingCheckInterval() const
+{
+	return m_stagingCheckInterval;
+}
+
+void QCATDataSource::dropStagingTables() const
+{
+	boost::mutex::scoped_lock lock(m_stagingMutex);
+	for(auto& item: m_stagingTables)
+		executeSQL("DROP TABLE IF EXISTS " + item.second.name);
+	m_stagingTables.clear();
+}
+
+bool QCATDataSource::loadBinCaches() const
+{
+	bool success;
+	auto exists = executeSQL("SELECT to_regclass('" + table() + "_bincache') IS NOT NULL AS e", &success);
+	if(!success || !exists->hasRows())
+		return false;
+
+	std::map<std::string,std::string> columns;
+	if(std::string(exists->get(0,"e")) == "t") {
+		auto rows = executeSQL("SELECT column_name, bin_expr FROM " + table() + "_bincache WHERE kind = 'column'", &success);
+		if(!success)
+			return false;
+		for(int i = 0; i < rows->nrows(); i++)
+			columns[rows->get(i,"bin_expr")] = rows->get(i,"column_name");
+	}
+
+	boost::mutex::scoped_lock lock(m_binCacheMutex);
+	m_binCacheColumns.swap(columns);
+	return true;
+}
+
+std::string QCATDataSource::binCacheColumnFor(std::string binExpr) const
+{
+	boost::mutex::scoped_lock lock(m_binCacheMutex);
+	auto it = m_binCacheColumns.find(boost::algorithm::trim_copy(binExpr));
+	return it == m_binCacheColumns.end() ? "" : it->second;
+}
+
+bool QCATDataSource::materialiseBinColumn(std::string field, std::string column, std::string binExpr) const
+{
+	ensureBinCacheCatalog();
+	binExpr = boost::algorithm::trim_copy(binExpr);
+	dropBinCaches(field, binExpr);
+
+	// a stored generated column is kept current by postgres for every later insert and update
+	bool success;
+	executeSQL("ALTER TABLE " + tableSafe() + " ADD COLUMN IF NOT EXISTS " + column 
+		+ " integer GENERATED ALWAYS AS (" + binExpr + ") STORED", &success);
+	if(!success) {
+		std::cerr << "*** QCATDataSource::materialiseBinColumn: unable to add " << column 
+			<< " (generated columns need Postgres 12+ and an immutable bin expression)" << std::endl;
+		return false;
+	}
+
+	executeSQL("INSERT INTO " + table() + "_bincache(column_name, field, bin_expr, kind) VALUES('" 
+		+ column + "','" + field + "','" + boost::replace_all_copy(binExpr, "'", "''") + "','column') ON CONFLICT (column_name) DO NOTHING");
+
+	boost::mutex::scoped_lock lock(m_binCacheMutex);
+	m_binCacheColumns[binExpr] = column;
+	return true;
+}
+
+bool QCATDataSource::createBinIndex(std::string field, std::string index, std::string binExpr) const
+{
+	ensureBinCacheCatalog();
+	binExpr = boost::algorithm::trim_copy(binExpr);
+	dropBinCaches(field, binExpr);
+
+	bool success;
+	executeSQL("CREATE INDEX IF NOT EXISTS " + index + " ON " + tableSafe() + " ((" + binExpr + "))", &success);
+	if(success)
+		executeSQL("INSERT INTO " + table() + "_bincache(column_name, field, bin_expr, kind) VALUES('" 
+			+ index + "','" + field + "','" + boost::replace_all_copy(binExpr, "'", "''") + "','index') ON CONFLICT (column_name) DO NOTHING");
+	return success;
+}
+
+void QCATDataSource::dropBinCaches() const
+{
+	dropBinCachesWhere("TRUE");
+}
+
+void QCATDataSource::dropBinCaches(std::string field, std::string keepBinExpr) const
+{
+	std::string where = "field = '" + boost::replace_all_copy(field, "'", "''") + "'";
+	if(!keepBinExpr.empty())
+		where += " AND bin_expr <> '" + boost::replace_all_copy(boost::algorithm::trim_copy(keepBinExpr), "'", "''") + "'";
+	dropBinCachesWhere(where);
+}
+
+void QCATDataSource::dropBinCachesWhere(const std::string& where) const
+{
+	bool success;
+	auto rows = executeSQL("SELECT column_name, kind FROM " + table() + "_bincache WHERE " + where, &success);
+	if(!success || rows->nrows() == 0)
+		return;
+
+	std::set<std::string> dropped;
+	for(int i = 0; i < rows->nrows(); i++) {
+		const std::string name = rows->get(i,"column_name");
+		if(std::string(rows->get(i,"kind")) == "index")
+			executeSQL("DROP INDEX IF EXISTS " + name);
+		else
+			executeSQL("ALTER TABLE " + tableSafe() + " DROP COLUMN IF EXISTS " + name);
+		dropped.insert(name);
+	}
+	executeSQL("DELETE FROM " + table() + "_bincache WHERE " + where);
+
+	boost::mutex::scoped_lock lock(m_binCacheMutex);
+	for(auto it = m_binCacheColumns.begin(); it != m_binCacheColumns.end(); ) {
+		if(dropped.count(it->second))
+			it = m_binCacheColumns.erase(it);
+		else
+			++it;
+	}
 }
 
 int QCATDataSource::totalRecords()
 {
-    int result = -1;
-    PGresult* r = PQexec(m_client, std::string("SELECT COUNT(*) FROM " + m_table).c_str());
-	char* val = PQgetvalue(r,0,0);
-    return boost::lexical_cast<int>(val);
+	bool success;
+	QCATDBResult r = executeSQL("SELECT COUNT(*) FROM " + m_table, &success);
+	if(!success || !r->hasRows())
+		return -1;
+    return r->getInt(0,0);
+}
+
+std::string QCATTableVersion::token() const
+{
+	return boost::lexical_cast<std::string>(inserted) + ":" + boost::lexical_cast<std::string>(updated) + ":" 
+		+ boost::lexical_cast<std::string>(deleted) + ":" + boost::lexical_cast<std::string>(maxID);
+}
+
+QCATTableVersion QCATTableVersion::fromToken(const std::string& token)
+{
+	QCATTableVersion version;
+	std::vector<std::string> parts;
+	boost::split(parts, token, boost::is_any_of(":"));
+	if(parts.size() != 4)
+		return version;
+
+	try {
+		version.inserted = boost::lexical_cast<long>(parts[0]);
+		version.updated = boost::lexical_cast<long>(parts[1]);
+		version.deleted = boost::lexical_cast<long>(parts[2]);
+		version.maxID = boost::lexical_cast<long>(parts[3]);
+		version.valid = true;
+	}
+	catch(boost::bad_lexical_cast e) {
+	}
+	return version;
+}
+
+QCATTableVersion QCATDataSource::tableVersion() const
+{
+	QCATTableVersion version;
+	bool success;
+	// matched by oid, so schema-qualified names work and a same-named table in another schema can't be picked
+	auto rows = executeSQL("SELECT n_tup_ins, n_tup_upd, n_tup_del, EXISTS (SELECT 1 FROM pg_attribute WHERE attrelid = relid "
+		"AND attname = 'id' AND NOT attisdropped) AS has_id FROM pg_stat_user_tables WHERE relid = to_regclass('" + table() + "')", &success);
+	if(!success || !rows->hasRows()) {
+		warnNoVersion("it has no statistics collector entry");
+		return version;
+	}
+	if(std::string(rows->get(0,"has_id")) != "t") {
+		warnNoVersion("it has no id column");
+		return version;
+	}
+
+	auto maxID = executeSQL("SELECT id FROM " + tableSafe() + " ORDER BY id DESC LIMIT 1", &success);
+	if(!success)
+		return version;
+
+	version.inserted = atol(rows->get(0,"n_tup_ins"));
+	version.updated = atol(rows->get(0,"n_tup_upd"));
+	version.deleted = atol(rows->get(0,"n_tup_del"));
+	version.maxID = maxID->hasRows() ? atol(maxID->get(0,0)) : 0;
+	version.valid = true;
+	return version;
+}
+
+void QCATDataSource::warnNoVersion(const std::string& why) const
+{
+	if(m_versionWarned.exchange(true))
+		return;
+	QCAT_LOG(qll_warning) << "QCATDataSource: no version for table " << table() << " because " << why
+		<< "; result caching, staging and change-aware stats are disabled for it";
 }
 
 QCATDBResult QCATDataSource::unique(std::string field, int limit)
 {
-    PGresult* r = PQexec(m_client, std::string("SELECT DISTINCT(" + field + ") FROM " + m_table + " WHERE " + LIMITING_CONDITION + " ORDER BY " + field + (limit == -1 ? "" : " LIMIT " + boost::lexical_cast<std::string>(limit))).c_str());
-	return shared_ptr<QCATPQResult>(new QCATPQResult(r));
+	return executeSQL("SELECT DISTINCT(" + field + ") FROM " + m_table + " WHERE " + LIMITING_CONDITION + " ORDER BY " + field + (limit == -1 ? "" : " LIMIT " + boost::lexical_cast<std::string>(limit)));
 }
 
 std::list<std::string> QCATDataSource::resultToList(QCATDBResult result, std::string field)
@@ -5,6 +5,10 @@
 #include <memory>
 #include <string>
 #include <list>
+#include <map>
+#include <ctime>
+#include <atomic>
+#include <boost/thread/mutex.hpp>
 
 using namespace std;
 
@@ -12,25 +16,145 @@ using namespace std;
 #include "qcatfieldmanager.h"
 #include "qcatpqresult.h"
 #include "qcatfieldstats.h"
+#include "qcattimings.h"
 
 typedef shared_ptr<QCATPQResult> QCATDBResult;
 
+class QCATResultCache;
+class QCATWarmCache;
+
+/*!
+ * \brief Lets a caller cancel a running query or bound how long it may run. A control is shared between
+ * the caller and the thread executing the queries; once cancelled or timed out, the running query is
+ * cancelled on the server and any further queries under the same control fail immediately.
+ */
+class QCATQueryControl
+{
+public:
+	/*!
+	 * \param timeoutSeconds Maximum time each query may run for (0 for no timeout)
+	 */
+	QCATQueryControl(double timeoutSeconds = 0);
+
+	void cancel();
+	bool cancelled() const;
+
+	void setTimeout(double seconds);
+	double timeout() const;
+
+	bool timedOut() const;
+	void setTimedOut();
+
+	/*!
+	 * \return True if the query should be abandoned (cancelled or timed out)
+	 */
+	bool stopped() const;
+
+private:
+	std::atomic<bool> m_cancelled, m_timedOut;
+	double m_timeout;
+};
+
+/*!
+ * \brief A cheap token identifying the current contents of a table. Built from the statistics
+ * collector's modification counters and the table's high-water id, so it changes whenever rows are
+ * inserted, updated or deleted. The counters lag writes: they are only reported once the writing
+ * transaction ends, and may then take up to about a second to show.
+ */
+struct QCATTableVersion
+{
+	QCATTableVersion()
+		:inserted(0), updated(0), deleted(0), maxID(0), valid(false) {}
+
+	long inserted, updated, deleted, maxID;
+	bool valid;
+
+	std::string token() const;
+	static QCATTableVersion fromToken(const std::string& token);
+
+	bool operator==(const QCATTableVersion& rhs) const {
+		return valid && rhs.valid && token() == rhs.token();
+	}
+	bool operator!=(const QCATTableVersion& rhs) const {
+		return !(*this == rhs);
+	}
+};
+
 class QCATDataSource
 {
 public:
-    QCATDataSource(std::string connStr, std::string table);
+	/*!
+	 * \param warmCacheDir If given, field definitions and stats are kept in a local file in this directory
+	 * so that later data sources on the same table can start without scanning the schema (see QCATWarmCache)
+	 */
+    QCATDataSource(std::string connStr, std::string table, std::string warmCacheDir = "");
     ~QCATDataSource();
 
     QCATDBResult unique(std::string field, int limit = -1);
+
+	/*!
+	 * \return The number of rows in the table, or -1 if they couldn't be counted
+	 */
     int totalRecords();
 
+	/*!
+	 * \brief Queries the current version token of this table: a pg_stat_user_tables lookup and a probe
+	 * for the highest id. The probe reads one index entry when id is indexed (e.g. the primary key), which
+	 * this relies on; without an index on id it scans the table. Tables without an id column have no
+	 * version (logged once as a warning).
+	 */
+	QCATTableVersion tableVersion() const;
+
+	/*!
+	 * \brief A hash of the table's identity and column definitions from pg_class/pg_attribute; changes
+	 * whenever the table is recreated or a column is added, dropped or altered
+	 */
+	std::string schemaFingerprint() const;
+
+	/*!
+	 * \brief Writes the field definitions and compiled stats to the warm-start cache, if one is in use.
+	 * Also done when the data source is destroyed.
+	 */
+	void saveWarmCache() const;
+
     static list<std::string> resultToList(QCATDBResult result, std::string field);
 
     shared_ptr<QCATField> fieldForName(std::string);
     shared_ptr<QCATFieldManager> fields() const;
 	std::vector<shared_ptr<QCATFieldStats> > fieldStats() const;
 
-    QCATDBResult executeSQL(std::string sql, bool* success = NULL) const;
+	/*!
+	 * \brief Loads cached stats for all given fields from the stats table in a single query. Stats for
+	 * fields with no acceptable cache entry come from the stats provider: exact stats are compiled and
+	 * saved in pipelined batches; planner estimates are read from pg_stats in one query.
+	 */
+	void prefetchFieldStats(std::vector<QCATField*> fields) const;
+
+	/*!
+	 * \brief Execute SQL on this data source's connection. Calls are serialised per data source; use
+	 * separate data sources to run queries concurrently.
+	 * \param control If given, the query is run without blocking on the socket so that it can be
+	 * cancelled or timed out through the control
+	 * \param timings If given, receives the server execution and transfer times and the rows and bytes
+	 * received (the query is then also run without blocking, to tell the two apart)
+	 */
+    QCATDBResult executeSQL(std::string sql, bool* success = NULL, QCATQueryControl* control = NULL, QCATQueryTimings* timings = NULL) const;
+
+	/*!
+	 * \brief Sets where stats not already in the stats cache come from (exact scans by default)
+	 * \param fallbackToExact With fsp_planner, compile exact stats (a full scan each) for fields the planner
+	 * has no statistics for; by default such fields get empty approximate stats
+	 */
+	void setStatsProvider(QCATFieldStatsProvider provider, bool fallbackToExact = false);
+	QCATFieldStatsProvider statsProvider() const;
+
+	/*!
+	 * \brief Execute several independent statements, sharing round trips using libpq's pipeline mode
+	 * where available (sequentially otherwise). A failing statement doesn't affect the others.
+	 * \param successes If given, receives the success of each statement
+	 * \return One result per statement, in order
+	 */
+	std::vector<QCATDBResult> executeSQLBatch(const std::vector<std::string>& sql, std::vector<bool>* successes = NULL) const;
 
 	/*!
 	 * \brief Execute a command a return the first row, first col result
@@ -40,19 +164,115 @@ public:
 	 */
 	std::string executeSQLSingleShot(std::string sql, bool wrap = false) const;
 
+	/*!
+	 * \brief Adds a stored generated column holding a bin expression (Postgres 12+; the expression must be
+	 * immutable) and records it in the bin cache catalog table (<table>_bincache). Postgres keeps the column
+	 * current, so it never goes stale. Adding it rewrites the table once. Columns and indexes cached for other
+	 * bins of the same field are dropped, so that changing a bin width doesn't leave the old one behind.
+	 */
+	bool materialiseBinColumn(std::string field, std::string column, std::string binExpr) const;
+
+	/*!
+	 * \brief Creates an expression index on a bin expression and records it in the bin cache catalog, dropping
+	 * those cached for other bins of the same field
+	 */
+	bool createBinIndex(std::string field, std::string index, std::string binExpr) const;
+
+	/*!
+	 * \brief The materialised column holding the given bin expression, or empty if none is known. Only
+	 * looks in memory: columns added by this data source, or read from the catalog by loadBinCaches().
+	 */
+	std::string binCacheColumnFor(std::string binExpr) const;
+
+	/*!
+	 * \brief Reads the bin cache catalog, so that columns materialised by other sessions are used too
+	 * \return False if the catalog couldn't be read
+	 */
+	bool loadBinCaches() const;
+
+	/*!
+	 * \brief Drops all materialised bin columns and bin indexes created by the library
+	 */
+	void dropBinCaches() const;
+
+	/*!
+	 * \brief Drops the materialised bin columns and bin indexes of one field
+	 * \param keepBinExpr If given, those holding this bin expression are kept
+	 */
+	void dropBinCaches(std::string field, std::string keepBinExpr = "") const;
+
+	/*!
+	 * \brief A table holding the rows of this table matching conditions, created (and ANALYZEd) on first
+	 * use and rebuilt when the table version changes. Staging tables live until the data source is destroyed.
+	 * \param unlogged Create an UNLOGGED table rather than a TEMP one, e.g. to inspect it from another session
+	 * \return The staging table's name, or empty if it could not be created or the table version is unknown
+	 */
+	std::string stagingTable(const std::string& conditions, bool unlogged) const;
+
+	/*!
+	 * \brief How long a staging table is reused before the table version is checked again (default 5 seconds;
+	 * 0 checks on every use). Rows written within the interval aren't seen by QCATs run against it.
+	 */
+	void setStagingCheckInterval(double seconds);
+	double stagingCheckInterval() const;
+
+	/*!
+	 * \brief Drops every staging table created by this data source
+	 */
+	void dropStagingTables() const;
+
+	/*!
+	 * \brief Cache of QCAT results for this table, shared by all QCATs using this data source
+	 */
+	shared_ptr<QCATResultCache> resultCache() const;
+
     std::string table() const;
 	std::string tableSafe() const;
 	std::string db() const;
 
 	bool goodConnection() const;
 
+	/*!
+	 * \brief The server's version number as from PQserverVersion, e.g. 140005 for 14.5 (0 if not connected)
+	 */
+	int serverVersion() const;
+
 private:
 	void ensureFieldStatTable() const;
+	PGresult* executeControlled(const std::string& sql, QCATQueryControl* control, QCATQueryTimings* timings) const;
+	void cancelRunningQuery() const;
+	void ensureBinCacheCatalog() const;
+	void warnNoVersion(const std::string& why) const;
+	void dropBinCachesWhere(const std::string& where) const;
 
 	bool m_goodConnection;
+	mutable bool m_statTableEnsured;
+	mutable boost::mutex m_statTableMutex;		// held until the stats table exists
+	mutable std::atomic<bool> m_versionWarned;		// a missing table version is only reported once
+	QCATFieldStatsProvider m_statsProvider;
+	bool m_statsFallbackToExact;
     shared_ptr<QCATFieldManager> m_fields;
+
+	// fresh materialised bin columns, keyed by bin expression
+	mutable std::map<std::string,std::string> m_binCacheColumns;
+	mutable boost::mutex m_binCacheMutex;
+	shared_ptr<QCATResultCache> m_resultCache;
+	shared_ptr<QCATWarmCache> m_warmCache;
+	std::string m_warmFingerprint, m_warmVersion;
+
+	// staging tables by conditions and kind; each is named after the table version it was built from
+	struct StagingTable {
+		std::string name, version;
+		time_t checkedAt;
+	};
+	mutable std::map<std::string,StagingTable> m_stagingTables;
+	double m_stagingCheckInterval;
+	mutable boost::mutex m_stagingMutex;
     std::string m_table, m_db;
     PGconn* m_client;
+
+	// a libpq connection must not be used from two threads at once
+	mutable boost::mutex m_mutex;
 };
 
 #endif // QCATDataSource_H
@@ -1,6 +1,9 @@
 #include "qcatfield.h"
 #include "qcatbin.h"
 #include <boost/lexical_cast.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/algorithm/string.hpp>
+#include <sstream>
 
 #include "qcatdatasource.h"
 #include "qcatbinnumeric.h"
@@ -9,11 +12,6 @@
 #include "qcatfieldstats.h"
 #include "qcatbinstats.h"
 
-#ifdef QCAT_VERBOSE
-#define BOOST_LOG_DYN_LINK 1
-#include <boost/log/trivial.hpp>
-#endif
-
 QCATField::QCATField(QCATDataSource* db, std::string name, int index, QCATFieldType type)
 {
     m_db = db;
@@ -39,51 +37,56 @@ void QCATField::initialise()
 
 QCATFieldStats QCATField::stats()
 {
-    if(m_cachedStats.get() == NULL)
-        m_cachedStats = shared_ptr<QCATFieldStats>(new QCATFieldStats(this, m_db));
-
-    return *m_cachedStats;
-}
+	// goes through the data source so its stats provider applies; it calls setStats(), so don't hold the lock
+	if(!hasStats())
+		m_db->prefetchFieldStats(std::vector<QCATField*>(1, this));
 
+	boost::mutex::scoped_lock lock(m_statsMutex);
+	if(m_cachedStats.get() == NULL)
+		m_cachedStats = shared_ptr<QCATFieldStats>(new QCATFieldStats(this, m_db));
 
+	return *m_cachedStats;
+}
 
-/*void QCATField::ensureBinIndex() const
+void QCATField::setStats(shared_ptr<QCATFieldStats> stats)
 {
-    if(m_bin->isPassthrough())
-        return;
+	boost::mutex::scoped_lock lock(m_statsMutex);
+	m_cachedStats = stats;
+}
 
-    try {
-        std::string sqlCreate = "CREATE INDEX " + indexName() + " ON " + m_db->table() + "(" + sqlBinExpr(name()) + ")";
-        bool success;
-        m_db->executeSQL(sqlCreate, &success);
-#ifdef QCAT_VERBOSE
-        if(success)
-			BOOST_LOG_TRIVIAL(info) << "Created bin index" << indexName() << std::endl;
-#endif
-    }
-    catch(exception e) {
-    }
+bool QCATField::hasStats() const
+{
+	boost::mutex::scoped_lock lock(m_statsMutex);
+	return (bool)m_cachedStats;
 }
 
 
+
+bool QCATField::isBinCacheName(std::string name)
+{
+    return name.find("_bincache_") == 0;
+}
+
 bool QCATField::isBinCache() const
 {
-    return name().find("_bincache_") != std::string::npos;
+    return isBinCacheName(name());
 }
 
-bool QCATField::isOriginalField() const
+std::string QCATField::binExprHash(std::string binExpr)
 {
-    return !isBinCache();
+	std::stringstream ss;
+	ss << std::hex << (boost::hash<std::string>()(boost::algorithm::trim_copy(binExpr)) & 0xffffffff);
+	return ss.str();
 }
 
-std::string QCATField::binCacheColumnName() const
+std::string QCATField::binCacheColumnName(std::string binExpr) const
 {
-    return "_bincache_" + name();// + "_" + boost::lexical_cast<std::string>(m_binSize);
-}*/
+    return "_bincache_" + name() + "_" + binExprHash(binExpr);
+}
 
-std::string QCATField::indexName() const
+std::string QCATField::indexName(std::string binExpr) const
 {
-    return "idx_" + name() + "_binned";
+    return "idx_" + name() + "_binned_" + binExprHash(binExpr);
 }
 
 /*std::string QCATField::nameBinned() const
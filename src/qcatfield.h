@@ -6,6 +6,7 @@
 #include <memory>
 #include <map>
 #include <vector>
+#include <boost/thread/mutex.hpp>
 
 #include "qcatbinstrategy.h"
 
@@ -62,6 +63,28 @@ public:
 
     QCATFieldStats stats();
 
+    /*!
+     * \brief Seeds the stats for this field, e.g. from a batched fetch, so stats() needs no queries
+     */
+    void setStats(shared_ptr<QCATFieldStats>);
+    bool hasStats() const;
+
+    /*!
+     * \brief True if this is a materialised bin column created by the library rather than an original field
+     */
+    bool isBinCache() const;
+    static bool isBinCacheName(std::string name);
+
+    /*!
+     * \brief Name of the materialised column holding the given bin expression of this field
+     */
+    std::string binCacheColumnName(std::string binExpr) const;
+
+     /*!
+     * \brief Provides a suitable name for a database index on the given bin expression of this field
+     */
+    std::string indexName(std::string binExpr) const;
+
     /*!
      * Gives the current database
      */
@@ -72,10 +95,7 @@ protected:
     void initialise();
 	std::string safePad(std::string str);
 
-     /*!
-     * \brief Provides a suitable name for a database index
-     */
-    std::string indexName() const;
+    static std::string binExprHash(std::string binExpr);
 
     std::string m_name;
     std::string m_table;
@@ -83,7 +103,9 @@ protected:
     QCATFieldType m_type;
     QCATDataSource* m_db;
 
+	// stats may be fetched from several async workers at once
 	shared_ptr<QCATFieldStats> m_cachedStats;
+	mutable boost::mutex m_statsMutex;
 };
 
 
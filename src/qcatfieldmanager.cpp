@@ -7,6 +7,16 @@ QCATFieldManager::QCATFieldManager(QCATDataSource* db)
     scan(db);
 }
 
+QCATFieldManager::QCATFieldManager()
+{
+}
+
+void QCATFieldManager::add(shared_ptr<QCATField> field)
+{
+	m_fieldMap[field->name()] = field;
+	m_fieldVector.push_back(field);
+}
+
 void QCATFieldManager::scan(QCATDataSource* db)
 {
     std::string sql = "select * from information_schema.columns where table_name = '" + db->table() + "'";
@@ -14,12 +24,12 @@ void QCATFieldManager::scan(QCATDataSource* db)
 
     for(int i=0;i<rows->nrows();i++) {
         std::string name = std::string(rows->get(i,"column_name"));
+        if(QCATField::isBinCacheName(name))
+            continue;
         int idx = rows->getInt(i,"ordinal_position");
         std::string type = std::string(rows->get(i,"data_type"));
 
-        auto field = shared_ptr<QCATField>(new QCATField(db,name,idx,fieldTypeFromStr(type)));
-        m_fieldMap[field->name()] = field;
-        m_fieldVector.push_back(field);
+        add(shared_ptr<QCATField>(new QCATField(db,name,idx,fieldTypeFromStr(type))));
     }
 }
 
@@ -17,6 +17,13 @@ class QCATFieldManager
 public:
     QCATFieldManager(QCATDataSource* db);
 
+	/*!
+	 * \brief An empty manager, filled with add() (e.g. from a warm-start cache)
+	 */
+	QCATFieldManager();
+
+	void add(shared_ptr<QCATField> field);
+
     std::vector<shared_ptr<QCATField> > vector() const;
     std::map<std::string,shared_ptr<QCATField> > map() const;
 //	std::map<std::string,std::vector<shared_ptr<QCATField> > > groupedByBinType() const;
@@ -3,13 +3,12 @@
 #include "qcatdatasource.h"
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
+#include <algorithm>
+#include <math.h>
 
 #define ACCEPTABLE_AGE_DAYS 30
 #define ENABLE_CACHE true
 
-#define BOOST_LOG_DYN_LINK 1
-#include <boost/log/trivial.hpp>
-
 QCATFieldStatResult::QCATFieldStatResult(std::string text)
     :text(text) {
     try {
@@ -25,143 +24,427 @@ QCATFieldStatResult::QCATFieldStatResult(std::string text)
 }
 
 QCATFieldStats::QCATFieldStats()
+	:m_unique(0), m_field(NULL), m_approximate(false), m_count(-1), m_sum(0), m_sumSq(0), m_highWater(0)
 {
 }
 
 QCATFieldStats::QCATFieldStats(const QCATField* field, const QCATDataSource* db)
-	:m_field((QCATField*)field)
+	:m_field((QCATField*)field), m_approximate(false), m_count(-1), m_sum(0), m_sumSq(0), m_highWater(0)
+{
+	if(ENABLE_CACHE && compileFromCache(field, db))
+		return;
+
+	setVersion(db->tableVersion());
+	compileStats(field, db);
+	saveToCache(field, db);
+}
+
+QCATFieldStats::QCATFieldStats(const QCATField* field, const QCATDBResult& rows, int row)
+	:m_field((QCATField*)field), m_approximate(false), m_count(-1), m_sum(0), m_sumSq(0), m_highWater(0)
+{
+	compileFromCacheRow(rows, row);
+}
+
+QCATFieldStats::QCATFieldStats(const QCATField* field, const std::vector<QCATDBResult>& results, const std::vector<bool>& successes)
+	:m_field((QCATField*)field), m_approximate(false), m_count(-1), m_sum(0), m_sumSq(0), m_highWater(0)
 {
-	if(ENABLE_CACHE) {
-		if(!cacheAcceptable(field,db)) {
-			compileStats(field, db);
-			ensureCache(field, db);
-			saveToCache(field, db);
+	compileFromResults(field, results, successes);
+}
+
+QCATFieldStats::QCATFieldStats(const QCATField* field, std::string avg, std::string min, std::string max, std::string stddev, long unique, std::string special)
+	:m_min(min), m_max(max), m_avg(avg), m_stddev(stddev), m_unique(unique), m_special(special), m_field((QCATField*)field), m_approximate(false), m_count(-1), m_sum(0), m_sumSq(0), m_highWater(0)
+{
+}
+
+std::string QCATFieldStats::sqlPlanner(const std::vector<QCATField*>& fields, const QCATDataSource* db)
+{
+	std::string names;
+	for(auto field: fields)
+		names += "'" + field->name() + "',";
+	names = names.substr(0, names.size()-1);
+
+	return "SELECT s.attname, s.null_frac, s.n_distinct, s.most_common_vals::text AS mcv, "
+		"s.most_common_freqs::text AS mcf, s.histogram_bounds::text AS hist, c.reltuples "
+		"FROM pg_stats s JOIN pg_class c ON s.tablename = c.relname AND s.schemaname = c.relnamespace::regnamespace::text "
+		"WHERE c.oid = to_regclass('" + db->table() + "') AND s.attname IN (" + names + ")";
+}
+
+shared_ptr<QCATFieldStats> QCATFieldStats::unavailable(const QCATField* field)
+{
+	auto stats = shared_ptr<QCATFieldStats>(new QCATFieldStats());
+	stats->m_field = (QCATField*)field;
+	stats->m_approximate = true;
+	stats->m_special = "No planner statistics (run ANALYZE)";
+	return stats;
+}
+
+shared_ptr<QCATFieldStats> QCATFieldStats::fromPlannerRow(const QCATField* field, const QCATDBResult& rows, int row)
+{
+	auto stats = unavailable(field);
+	// NULL arrays come back as empty strings
+	auto get = [&](const char* col) -> std::string {
+		return std::string(rows->get(row, col));
+	};
+
+	const double nullFrac = rows->getDouble(row, "null_frac");
+	const double nDistinct = rows->getDouble(row, "n_distinct");
+	const double reltuples = std::max(0.0, rows->getDouble(row, "reltuples"));
+	const auto mcv = parseArrayLiteral(get("mcv"));
+	const auto hist = parseArrayLiteral(get("hist"));
+	std::vector<double> mcf;
+	for(auto& f: parseArrayLiteral(get("mcf")))
+		mcf.push_back(boost::lexical_cast<double>(f));
+
+	// negative n_distinct is a fraction of the row count
+	stats->m_unique = (long)(nDistinct >= 0 ? nDistinct : -nDistinct * reltuples);
+
+	std::vector<std::string> all(hist);
+	all.insert(all.end(), mcv.begin(), mcv.end());
+	if(all.empty())
+		return stats;
+
+	std::vector<double> numeric;
+	try {
+		for(auto& v: all)
+			numeric.push_back(boost::lexical_cast<double>(v));
+	}
+	catch(boost::bad_lexical_cast e) {
+		numeric.clear();
+	}
+
+	if(!numeric.empty()) {
+		stats->m_min = QCATFieldStatResult(boost::lexical_cast<std::string>(*std::min_element(numeric.begin(), numeric.end())));
+		stats->m_max = QCATFieldStatResult(boost::lexical_cast<std::string>(*std::max_element(numeric.begin(), numeric.end())));
+
+		// mixture of the MCV point masses and the histogram, whose buckets each hold an equal share of
+		// the remaining rows spread uniformly between their bounds
+		double mass = 0, sum = 0, sumSq = 0;
+		for(size_t i = 0; i < mcf.size() && i < mcv.size(); ++i) {
+			const double x = numeric[hist.size() + i];
+			mass += mcf[i];
+			sum += mcf[i] * x;
+			sumSq += mcf[i] * x * x;
+		}
+		if(hist.size() > 1) {
+			const double bucket = std::max(0.0, 1.0 - nullFrac - mass) / (hist.size() - 1);
+			for(size_t i = 0; i + 1 < hist.size(); ++i) {
+				const double a = numeric[i], b = numeric[i+1];
+				sum += bucket * (a + b) / 2.0;
+				sumSq += bucket * (a*a + a*b + b*b) / 3.0;
+				mass += bucket;
+			}
 		}
-		else {
-			compileFromCache(field, db);
+		if(mass > 0) {
+			const double mean = sum / mass;
+			stats->m_avg = QCATFieldStatResult(boost::lexical_cast<std::string>(mean));
+			stats->m_stddev = QCATFieldStatResult(boost::lexical_cast<std::string>(sqrt(std::max(0.0, sumSq / mass - mean * mean))));
 		}
 	}
 	else {
-		compileStats(field, db);
-		saveToCache(field, db);
+		// text order matches value order for ISO timestamps; for strings it is an approximation of the collation
+		stats->m_min = QCATFieldStatResult(*std::min_element(all.begin(), all.end()));
+		stats->m_max = QCATFieldStatResult(*std::max_element(all.begin(), all.end()));
 	}
+
+	stats->m_special = "Estimated from planner statistics";
+	if(field->type() == fft_boolean) {
+		double t = 0, f = 0;
+		for(size_t i = 0; i < mcf.size() && i < mcv.size(); ++i)
+			(mcv[i] == "t" ? t : f) += mcf[i];
+		// a column the planner saw no false values in has no finite ratio
+		if(f > 0)
+			stats->m_special += "; True/False ratio: " + boost::str(boost::format("%.2f") % (t/f));
+		else if(t > 0)
+			stats->m_special += "; True/False ratio: all true";
+	}
+	else if(field->type() == fft_string && !mcv.empty()) {
+		std::string examples;
+		for(size_t i = 0; i < mcv.size() && i < 5; ++i)
+			examples += mcv[i] + ", ";
+		stats->m_special += "; Examples: " + examples.substr(0, examples.size()-2);
+	}
+	return stats;
 }
 
-void QCATFieldStats::ensureCache(const QCATField* f, const QCATDataSource* db)
+std::vector<std::string> QCATFieldStats::parseArrayLiteral(const std::string& text)
 {
-    bool success;
-    db->executeSQL("INSERT INTO " + db->table() + "_stats(field,last_compiled) VALUES('" + f->name() + "','01-01-3000')",&success);
+	// Postgres array text: {a,"b c",NULL}, with backslash escapes inside quotes
+	std::vector<std::string> items;
+	if(text.size() < 2 || text[0] != '{')
+		return items;
+
+	std::string cur;
+	bool quoted = false, wasQuoted = false;
+	for(size_t i = 1; i < text.size(); ++i) {
+		const char c = text[i];
+		if(quoted) {
+			if(c == '\\' && i + 1 < text.size())
+				cur += text[++i];
+			else if(c == '"')
+				quoted = false;
+			else
+				cur += c;
+		}
+		else if(c == '"') {
+			quoted = wasQuoted = true;
+		}
+		else if(c == ',' || c == '}') {
+			if(wasQuoted || (!cur.empty() && cur != "NULL"))
+				items.push_back(cur);
+			cur.clear();
+			wasQuoted = false;
+		}
+		else
+			cur += c;
+	}
+	return items;
 }
 
-bool QCATFieldStats::cacheAcceptable(const QCATField* f, const QCATDataSource* db) const
+std::string QCATFieldStats::sqlCacheColumns()
 {
-    bool success;
-	BOOST_LOG_TRIVIAL(info) << "Is cache acceptable" << endl;
-    double age = executeSingleShot<double>("select extract(epoch from last_compiled - now()) / 86400 from " + db->table() + "_stats WHERE field = '" + f->name() + "'", db, &success);
-	BOOST_LOG_TRIVIAL(info) << "Age " << age;
-	BOOST_LOG_TRIVIAL(info) << "Success " << success;
-    return (age <= ACCEPTABLE_AGE_DAYS) && success;
+	return "avg,min,max,stddev,_unique,special,n_rows,sum,sum_sq,table_version,high_water";
+}
+
+QCATStatsCacheState QCATFieldStats::cacheState(const QCATDBResult& rows, int row, const QCATTableVersion& current)
+{
+	const std::string token = rows->hasCol("table_version") ? rows->get(row,"table_version") : "";
+	if(token.empty() || !current.valid)
+		return rows->getDouble(row,"_age") <= ACCEPTABLE_AGE_DAYS ? scs_fresh : scs_stale;
+
+	const QCATTableVersion stored = QCATTableVersion::fromToken(token);
+	if(!stored.valid)
+		return scs_stale;
+	if(stored.token() == current.token())
+		return scs_fresh;
+
+	// only inserts, all beyond the recorded high-water id (counters going backwards means they were reset)
+	const bool appendOnly = stored.updated == current.updated && stored.deleted == current.deleted
+		&& current.inserted >= stored.inserted && current.maxID > stored.maxID;
+	const bool mergeable = std::string(rows->get(row,"high_water")) != "";
+	return appendOnly && mergeable ? scs_appended : scs_stale;
 }
 
-void QCATFieldStats::compileFromCache(const QCATField* f, const QCATDataSource* db)
+void QCATFieldStats::setVersion(const QCATTableVersion& version)
+{
+	m_version = version.valid ? version.token() : "";
+	m_highWater = version.maxID;
+}
+
+bool QCATFieldStats::isNumeric(const QCATField* field)
+{
+	return field->type() == fft_integer || field->type() == fft_double;
+}
+
+bool QCATFieldStats::hasMoments() const
+{
+	return m_count >= 0;
+}
+
+std::string QCATFieldStats::sqlIncremental(const QCATDataSource* db) const
+{
+	const std::string fn = m_field->name();
+	std::string sql = "SELECT COUNT(" + fn + ") AS n, MIN(" + fn + ")::text AS min, MAX(" + fn + ")::text AS max, "
+		"COUNT(DISTINCT " + fn + ") AS _unique";
+	if(isNumeric(m_field))
+		sql += ", SUM(" + fn + "::float8) AS sum, SUM(" + fn + "::float8 * " + fn + "::float8) AS sum_sq";
+	return sql + " FROM " + db->tableSafe() + " WHERE id > " + boost::lexical_cast<std::string>(m_highWater);
+}
+
+bool QCATFieldStats::mergeIncremental(const QCATDBResult& result)
+{
+	if(!result->hasRows() || (isNumeric(m_field) && !hasMoments()))
+		return false;
+
+	const long n = result->getInt(0,"n");
+	if(n == 0)
+		return true;
+
+	const std::string lo = result->get(0,"min"), hi = result->get(0,"max");
+	if(m_min.text.empty() || (m_min.reliable_numeric ? atof(lo.c_str()) < m_min.numeric : lo < m_min.text))
+		m_min = QCATFieldStatResult(lo);
+	if(m_max.text.empty() || (m_max.reliable_numeric ? atof(hi.c_str()) > m_max.numeric : hi > m_max.text))
+		m_max = QCATFieldStatResult(hi);
+
+	// new values may repeat old ones, so this only bounds the distinct count from above
+	m_unique += result->getInt(0,"_unique");
+
+	if(isNumeric(m_field)) {
+		m_count += n;
+		m_sum += result->getDouble(0,"sum");
+		m_sumSq += result->getDouble(0,"sum_sq");
+		m_unique = std::min(m_unique, m_count);
+
+		const double mean = m_sum / m_count;
+		m_avg = QCATFieldStatResult(boost::lexical_cast<std::string>(mean));
+		if(m_count > 1)
+			m_stddev = QCATFieldStatResult(boost::lexical_cast<std::string>(sqrt(std::max(0.0, (m_sumSq - m_sum * mean) / (m_count - 1)))));
+	}
+	return true;
+}
+
+double QCATFieldStats::acceptableAgeDays()
+{
+	return ACCEPTABLE_AGE_DAYS;
+}
+
+bool QCATFieldStats::compileFromCache(const QCATField* f, const QCATDataSource* db)
 {
     bool success;
-    auto result = db->executeSQL("SELECT avg,min,max,stddev,_unique,special FROM " + db->table() + "_stats WHERE field = '" + f->name() + "'", &success);
+    auto result = db->executeSQL("SELECT " + sqlCacheColumns() + ", extract(epoch from now() - last_compiled) / 86400 AS _age FROM " 
+			+ db->table() + "_stats WHERE field = '" + f->name() + "'", &success);
+	if(!success || result->nrows() == 0)
+		return false;
+
+	const QCATTableVersion version = db->tableVersion();
+	switch(cacheState(result, 0, version)) {
+		case scs_fresh:
+			compileFromCacheRow(result, 0);
+			return true;
+		case scs_appended:
+			{
+			compileFromCacheRow(result, 0);
+			auto rows = db->executeSQL(sqlIncremental(db), &success);
+			if(!success || !mergeIncremental(rows))
+				return false;
+			setVersion(version);
+			saveToCache(f, db);
+			return true;
+			}
+		default:
+			return false;
+	}
+}
 
-#define getr(name) result->hasCol(name) ? std::string(result->get(0,name)) : "-1"
+void QCATFieldStats::compileFromCacheRow(const QCATDBResult& result, int row)
+{
+#define getr(name) result->hasCol(name) ? std::string(result->get(row,name)) : "-1"
 
     m_avg = getr("avg");
     m_min = getr("min");
     m_max = getr("max");
     m_stddev = getr("stddev");
-	m_unique = result->getInt(0,"_unique");
+	m_unique = result->getInt(row,"_unique");
     m_special = getr("special");
+
+	const bool moments = result->hasCol("n_rows") && std::string(result->get(row,"n_rows")) != "";
+	m_count = moments ? result->getInt(row,"n_rows") : -1;
+	m_sum = moments ? result->getDouble(row,"sum") : 0;
+	m_sumSq = moments ? result->getDouble(row,"sum_sq") : 0;
+	m_version = result->hasCol("table_version") ? result->get(row,"table_version") : "";
+	m_highWater = result->hasCol("high_water") ? atol(result->get(row,"high_water")) : 0;
 }
 
-void QCATFieldStats::saveToCache(const QCATField* f, const QCATDataSource* db)
+std::vector<std::string> QCATFieldStats::sqlSaveToCache(const QCATField* f, const QCATDataSource* db) const
 {
-    bool success;
-    db->executeSQL("UPDATE " + db->table() + "_stats SET(avg,min,max,stddev,_unique,special,last_compiled) = ('" +
+	const std::string st = db->table() + "_stats";
+	std::vector<std::string> sql;
+	sql.push_back("INSERT INTO " + st + "(field,last_compiled) SELECT '" + f->name() + "','01-01-3000' "
+			"WHERE NOT EXISTS (SELECT 1 FROM " + st + " WHERE field = '" + f->name() + "')");
+	sql.push_back("UPDATE " + st + " SET(avg,min,max,stddev,_unique,special,n_rows,sum,sum_sq,table_version,high_water,last_compiled) = ('" +
                    m_avg.text + "','" + m_min.text + "','" + m_max.text + "','" + m_stddev.text + "'," +
-                   boost::lexical_cast<std::string>(m_unique) + ",'" + m_special + "',now()) WHERE field = '" + f->name() + "'");
+                   boost::lexical_cast<std::string>(m_unique) + ",'" + m_special + "'," +
+                   (hasMoments() ? boost::lexical_cast<std::string>(m_count) + "," + boost::lexical_cast<std::string>(m_sum) + "," 
+					   + boost::lexical_cast<std::string>(m_sumSq) : "NULL,NULL,NULL") + "," +
+                   (m_version.empty() ? "NULL,NULL" : "'" + m_version + "'," + boost::lexical_cast<std::string>(m_highWater)) +
+                   ",now()) WHERE field = '" + f->name() + "'");
+	return sql;
 }
 
-void QCATFieldStats::compileStats(const QCATField* field, const QCATDataSource *db)
+void QCATFieldStats::saveToCache(const QCATField* f, const QCATDataSource* db)
+{
+	db->executeSQLBatch(sqlSaveToCache(f, db));
+}
+
+std::vector<std::string> QCATFieldStats::sqlCompile(const QCATField* field, const QCATDataSource* db)
 {
     const std::string fn = field->name();
     const std::string tn = db->table();
-    bool success;
-    m_unique = executeSingleShot<long>("SELECT COUNT(DISTINCT " + fn + ") AS result FROM " + tn, db, &success);
-    m_min = runStat("SELECT MIN(" + fn + ") AS result FROM " + tn, db);
-    m_max = runStat("SELECT MAX(" + fn + ") AS result FROM " + tn, db);
-    m_stddev = runStat("SELECT STDDEV(" + fn + ") AS result FROM " + tn, db);
-    m_avg = runStat("SELECT AVG(" + fn + ") AS result FROM " + tn, db);
+
+	// one statement per stat: a failure (e.g. AVG of a string) only loses that stat
+	std::vector<std::string> sql;
+    sql.push_back("SELECT COUNT(DISTINCT " + fn + ") AS result FROM " + tn);
+    sql.push_back("SELECT MIN(" + fn + ") AS result FROM " + tn);
+    sql.push_back("SELECT MAX(" + fn + ") AS result FROM " + tn);
+    sql.push_back("SELECT STDDEV(" + fn + ") AS result FROM " + tn);
+    sql.push_back("SELECT AVG(" + fn + ") AS result FROM " + tn);
 
     switch(field->type()) {
         case fft_string:
-            m_special = "Average string length: " + boost::lexical_cast<std::string>(executeSingleShot<double>("SELECT AVG(LENGTH(" + fn +")) FROM " + tn,db,&success));
-            m_special += "; Examples: " + executeToCommaSepList("SELECT DISTINCT " + fn + " FROM " + tn + " ORDER BY " + fn + " LIMIT 5",db);
+            sql.push_back("SELECT AVG(LENGTH(" + fn +")) FROM " + tn);
+            sql.push_back("SELECT DISTINCT " + fn + " FROM " + tn + " ORDER BY " + fn + " LIMIT 5");
             break;
         case fft_boolean:
-			{
-            long t = boost::lexical_cast<long>(executeSingleShot<long>("SELECT COUNT(" + fn + ") FROM " + tn + " WHERE " + fn + " = true",db,&success));
-            long f = boost::lexical_cast<long>(executeSingleShot<long>("SELECT COUNT(" + fn + ")) FROM " + tn + " WHERE " + fn + " = false",db,&success));
-            double ratio = t/(double)f;
-            m_special = std::string("True/False ratio: ") + (boost::str(boost::format("%.2f") % ratio));
+            sql.push_back("SELECT COUNT(" + fn + ") FROM " + tn + " WHERE " + fn + " = true");
+            sql.push_back("SELECT COUNT(" + fn + ") FROM " + tn + " WHERE " + fn + " = false");
+            break;
+        case fft_integer:
+        case fft_double:
+            sql.push_back("SELECT COUNT(" + fn + "), SUM(" + fn + "::float8), SUM(" + fn + "::float8 * " + fn + "::float8) FROM " + tn);
             break;
-			}
 		default:
-			m_special = "";
-    }
-}
-
-std::string QCATFieldStats::executeToCommaSepList(std::string str, const QCATDataSource* db) const
-{
-    bool success;
-    auto result = db->executeSQL(str, &success);
-    if(success) {
-        std::string resultStr;
-        for(int i=0;i<result->ncols();i++)
-            resultStr += std::string(result->get(0,i)) + ", ";
-        return resultStr.substr(0,resultStr.size()-2);
+			break;
     }
-    else return "";
+	return sql;
 }
 
-QCATFieldStatResult QCATFieldStats::runStat(std::string sql, const QCATDataSource *db) const
+void QCATFieldStats::compileStats(const QCATField* field, const QCATDataSource *db)
 {
-    bool success;
-    return QCATFieldStatResult(executeSingleShot<std::string>(sql,db,&success));
+	std::vector<bool> successes;
+	auto results = db->executeSQLBatch(sqlCompile(field, db), &successes);
+	compileFromResults(field, results, successes);
 }
 
-template<class T>
-T QCATFieldStats::executeSingleShot(std::string str, const QCATDataSource *db, bool *success) const
+void QCATFieldStats::compileFromResults(const QCATField* field, const std::vector<QCATDBResult>& results, const std::vector<bool>& successes)
 {
-    T val;
-    auto result = db->executeSQL(str,success);
-	if(success) *success = true;
-    try {
-		if(result->ncols() > 0 && result->nrows() > 0)
-			val = boost::lexical_cast<T>(result->get(0,0));
-		else {
-			if(success) *success = false;
+	auto text = [&](size_t i) -> std::string {
+		if(i >= results.size() || !successes[i] || results[i]->nrows() == 0 || results[i]->ncols() == 0)
+			return "";
+		return std::string(results[i]->get(0,0));
+	};
+	auto number = [&](size_t i) -> double {
+		try {
+			return boost::lexical_cast<double>(text(i));
+		}
+		catch(boost::bad_lexical_cast e) {
 			return 0;
 		}
-    }
-    catch(exception e) {
-		if(success) *success = false;
-        return 0;
-    }
-	return val;
-}
+	};
 
-template<>
-std::string QCATFieldStats::executeSingleShot<std::string>(std::string str, const QCATDataSource *db, bool *success) const
-{
-    std::string val;
-    auto result = db->executeSQL(str,success);
-    if(*success) {
-        return std::string(result->get(0,"result"));
+    m_unique = (long)number(0);
+    m_min = QCATFieldStatResult(text(1));
+    m_max = QCATFieldStatResult(text(2));
+    m_stddev = QCATFieldStatResult(text(3));
+    m_avg = QCATFieldStatResult(text(4));
+
+    switch(field->type()) {
+        case fft_string:
+			{
+            m_special = "Average string length: " + boost::lexical_cast<std::string>(number(5));
+			std::string examples;
+			if(text(6) != "") {
+				for(int i=0;i<results[6]->ncols();i++)
+					examples += std::string(results[6]->get(0,i)) + ", ";
+				examples = examples.substr(0,examples.size()-2);
+			}
+            m_special += "; Examples: " + examples;
+            break;
+			}
+        case fft_boolean:
+			{
+            double ratio = number(5)/number(6);
+            m_special = std::string("True/False ratio: ") + (boost::str(boost::format("%.2f") % ratio));
+            break;
+			}
+        case fft_integer:
+        case fft_double:
+			m_special = "";
+			if(text(5) != "") {
+				m_count = atol(results[5]->get(0,0));
+				m_sum = atof(results[5]->get(0,1));
+				m_sumSq = atof(results[5]->get(0,2));
+			}
+			break;
+		default:
+			m_special = "";
     }
-    else return "";
 }
@@ -2,9 +2,32 @@
 #define FACASFIELDSTATS_H
 
 #include <string>
+#include <memory>
+#include <vector>
 
 class QCATField;
 class QCATDataSource;
+class QCATPQResult;
+struct QCATTableVersion;
+
+/*!
+ * \brief Validity of a stats cache row against the table's current version
+ */
+enum QCATStatsCacheState
+{
+	scs_fresh = 0,		// table unchanged since the stats were compiled
+	scs_appended = 1,	// rows only appended since; stats can be merged from the new rows
+	scs_stale = 2		// must be recompiled
+};
+
+/*!
+ * \brief Where field stats come from when they aren't in the stats cache
+ */
+enum QCATFieldStatsProvider
+{
+	fsp_exact = 0,		// aggregate queries over the whole table
+	fsp_planner = 1		// estimated from the planner's pg_stats (histogram bounds, MCVs, n_distinct); no table scans
+};
 
 class QCATFieldStatResult
 {
@@ -41,6 +64,78 @@ public:
     QCATFieldStats();
     QCATFieldStats(const QCATField*, const QCATDataSource* db);
 
+    /*!
+     * \brief Builds stats from a row already fetched from the stats cache table (see QCATDataSource::prefetchFieldStats)
+     */
+    QCATFieldStats(const QCATField*, const std::shared_ptr<QCATPQResult>& rows, int row);
+
+    /*!
+     * \brief Builds stats from the results of the queries given by sqlCompile(), in the same order
+     */
+    QCATFieldStats(const QCATField*, const std::vector<std::shared_ptr<QCATPQResult> >& results, const std::vector<bool>& successes);
+
+    /*!
+     * \brief Estimates stats from a row of the query given by sqlPlanner()
+     */
+    static std::shared_ptr<QCATFieldStats> fromPlannerRow(const QCATField*, const std::shared_ptr<QCATPQResult>& rows, int row);
+
+    /*!
+     * \brief Empty, approximate stats for a field the planner has no statistics for
+     */
+    static std::shared_ptr<QCATFieldStats> unavailable(const QCATField*);
+
+    /*!
+     * \brief Query fetching planner statistics for the given fields in one go (one row per field with stats)
+     */
+    static std::string sqlPlanner(const std::vector<QCATField*>& fields, const QCATDataSource* db);
+
+    /*!
+     * \brief Builds stats from previously compiled values (see QCATWarmCache)
+     */
+    QCATFieldStats(const QCATField*, std::string avg, std::string min, std::string max, std::string stddev, long unique, std::string special);
+
+    /*!
+     * \brief The queries that compile stats for a field; independent of each other so they can be pipelined
+     */
+    static std::vector<std::string> sqlCompile(const QCATField*, const QCATDataSource* db);
+
+    /*!
+     * \brief The statements that write these stats to the stats cache table
+     */
+    std::vector<std::string> sqlSaveToCache(const QCATField*, const QCATDataSource* db) const;
+
+    /*!
+     * \brief Validity of a row of the stats cache table (selected with sqlCacheColumns() and _age) given
+     * the table's current version. Rows without a recorded version fall back to their age.
+     */
+    static QCATStatsCacheState cacheState(const std::shared_ptr<QCATPQResult>& rows, int row, const QCATTableVersion& current);
+
+    /*!
+     * \brief Query aggregating only the rows appended since these stats were compiled (id above the high-water mark)
+     */
+    std::string sqlIncremental(const QCATDataSource* db) const;
+
+    /*!
+     * \brief Merges the result of sqlIncremental() into these stats. The unique count becomes an upper bound.
+     * \return False if the stats can't be merged and should be recompiled
+     */
+    bool mergeIncremental(const std::shared_ptr<QCATPQResult>& result);
+
+    /*!
+     * \brief Records the table version these stats describe (saved with them to the cache)
+     */
+    void setVersion(const QCATTableVersion& version);
+
+    /*!
+     * \brief SQL columns needed to build stats from a cache row
+     */
+    static std::string sqlCacheColumns();
+
+    /*!
+     * \brief Maximum age of a stats cache entry before it is recompiled
+     */
+    static double acceptableAgeDays();
+
     QCATFieldStatResult min() const { return m_min; }
     QCATFieldStatResult max() const { return m_max; }
     QCATFieldStatResult stddev() const { return m_stddev; }
@@ -52,25 +147,34 @@ public:
 
     std::string special() const { return m_special; }
 
+    /*!
+     * \brief True if these stats are estimates (from pg_stats) rather than exact aggregates
+     */
+    bool approximate() const { return m_approximate; }
+
 private:
-    bool cacheAcceptable(const QCATField*, const QCATDataSource* db) const;
-    void compileFromCache(const QCATField*, const QCATDataSource* db);
+    bool compileFromCache(const QCATField*, const QCATDataSource* db);
+    bool hasMoments() const;
+    static bool isNumeric(const QCATField*);
+    void compileFromCacheRow(const std::shared_ptr<QCATPQResult>& rows, int row);
+    void compileFromResults(const QCATField*, const std::vector<std::shared_ptr<QCATPQResult> >& results, const std::vector<bool>& successes);
     void saveToCache(const QCATField*, const QCATDataSource* db);
-    void ensureCache(const QCATField*, const QCATDataSource* db);
 
     void compileStats(const QCATField*, const QCATDataSource* db);
-    QCATFieldStatResult runStat(std::string sql, const QCATDataSource *db) const;
 
-    template<class T>T executeSingleShot(std::string str, const QCATDataSource *db, bool* success) const;
-    std::string executeToCommaSepList(std::string str, const QCATDataSource* db) const;
+    static std::vector<std::string> parseArrayLiteral(const std::string& text);
 
     QCATFieldStatResult m_min, m_max, m_avg, m_stddev;
     long m_unique;
     std::string m_special;
 	QCATField* m_field;
-};
+	bool m_approximate;
 
-template<>
-std::string QCATFieldStats::executeSingleShot<std::string>(std::string str, const QCATDataSource *db, bool *success) const;
+	// count, sum and sum of squares of non-null values (numeric fields), kept for incremental merges
+	long m_count;
+	double m_sum, m_sumSq;
+	std::string m_version;
+	long m_highWater;
+};
 
 #endif // FACASFIELDSTATS_H
@@ -0,0 +1,85 @@
+#include "qcatlattice.h"
+
+QCATLattice::QCATLattice(std::vector<std::string> conditionals)
+	:m_conditionals(conditionals)
+{
+}
+
+std::string QCATLattice::key(const std::map<std::string,std::string>& fixed)
+{
+	std::string str;
+	for(auto item: fixed)
+		str += item.first + "=" + item.second + "\x1f";
+	return str;
+}
+
+void QCATLattice::add(const QCATLatticeNode& node)
+{
+	const std::string k = key(node.fixed);
+	auto it = m_index.find(k);
+	if(it != m_index.end()) {
+		m_nodes[it->second] = node;
+		return;
+	}
+	m_index[k] = m_nodes.size();
+	m_nodes.push_back(node);
+}
+
+const QCATLatticeNode* QCATLattice::root() const
+{
+	return find(std::map<std::string,std::string>());
+}
+
+const QCATLatticeNode* QCATLattice::find(const std::map<std::string,std::string>& fixed) const
+{
+	auto it = m_index.find(key(fixed));
+	return it == m_index.end() ? NULL : &m_nodes[it->second];
+}
+
+bool QCATLattice::extends(const QCATLatticeNode& a, const QCATLatticeNode& b)
+{
+	// true if a fixes exactly one more conditional than b and agrees with b elsewhere
+	if(a.fixed.size() != b.fixed.size() + 1)
+		return false;
+	for(auto item: b.fixed) {
+		auto it = a.fixed.find(item.first);
+		if(it == a.fixed.end() || it->second != item.second)
+			return false;
+	}
+	return true;
+}
+
+std::vector<const QCATLatticeNode*> QCATLattice::children(const QCATLatticeNode& node) const
+{
+	std::vector<const QCATLatticeNode*> result;
+	for(auto& n: m_nodes) {
+		if(extends(n, node))
+			result.push_back(&n);
+	}
+	return result;
+}
+
+std::vector<const QCATLatticeNode*> QCATLattice::parents(const QCATLatticeNode& node) const
+{
+	std::vector<const QCATLatticeNode*> result;
+	for(auto& n: m_nodes) {
+		if(extends(node, n))
+			result.push_back(&n);
+	}
+	return result;
+}
+
+std::vector<const QCATLatticeNode*> QCATLattice::level(const std::set<std::string>& fixedConditionals) const
+{
+	std::vector<const QCATLatticeNode*> result;
+	for(auto& n: m_nodes) {
+		if(n.fixed.size() != fixedConditionals.size())
+			continue;
+		bool match = true;
+		for(auto item: n.fixed)
+			match = match && fixedConditionals.count(item.first);
+		if(match)
+			result.push_back(&n);
+	}
+	return result;
+}
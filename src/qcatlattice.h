@@ -0,0 +1,70 @@
+#ifndef QCATLATTICE_H
+#define QCATLATTICE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "qcat.h"
+
+/*!
+ * \brief A node in a conditional lattice: the QCAT evaluated with some conditionals fixed to (binned) values
+ * and the rest left free
+ */
+struct QCATLatticeNode
+{
+	std::map<std::string,std::string> fixed;	// conditional -> binned value; free conditionals are absent
+	QCATSummary summary;
+};
+
+/*!
+ * \brief The results of evaluating a QCAT for every combination of a set of conditionals (a data cube),
+ * navigable from the root (nothing fixed) down to nodes with every conditional fixed
+ */
+class QCATLattice
+{
+public:
+	QCATLattice() {}
+	QCATLattice(std::vector<std::string> conditionals);
+
+	void add(const QCATLatticeNode& node);
+
+	std::vector<std::string> conditionals() const { return m_conditionals; }
+	const std::vector<QCATLatticeNode>& nodes() const { return m_nodes; }
+	size_t size() const { return m_nodes.size(); }
+
+	/*!
+	 * \return The node with nothing fixed (the QCAT ignoring all lattice conditionals), or NULL
+	 */
+	const QCATLatticeNode* root() const;
+
+	/*!
+	 * \return The node with exactly the given conditionals fixed to the given values, or NULL
+	 */
+	const QCATLatticeNode* find(const std::map<std::string,std::string>& fixed) const;
+
+	/*!
+	 * \brief Drill down: nodes fixing one more conditional than the given node, agreeing on the rest
+	 */
+	std::vector<const QCATLatticeNode*> children(const QCATLatticeNode& node) const;
+
+	/*!
+	 * \brief Roll up: nodes fixing one fewer conditional than the given node
+	 */
+	std::vector<const QCATLatticeNode*> parents(const QCATLatticeNode& node) const;
+
+	/*!
+	 * \brief All nodes fixing exactly the given set of conditionals
+	 */
+	std::vector<const QCATLatticeNode*> level(const std::set<std::string>& fixedConditionals) const;
+
+private:
+	static std::string key(const std::map<std::string,std::string>& fixed);
+	static bool extends(const QCATLatticeNode& a, const QCATLatticeNode& b);
+
+	std::vector<std::string> m_conditionals;
+	std::vector<QCATLatticeNode> m_nodes;
+	std::map<std::string,size_t> m_index;
+};
+
+#endif // QCATLATTICE_H
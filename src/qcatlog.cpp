@@ -0,0 +1,115 @@
+#include "qcatlog.h"
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include <boost/algorithm/string.hpp>
+
+#define BOOST_LOG_DYN_LINK 1
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/text_file_backend.hpp>
+#include <boost/log/sinks/bounded_fifo_queue.hpp>
+#include <boost/log/sinks/drop_on_overflow.hpp>
+#include <boost/log/support/date_time.hpp>
+#include <boost/log/utility/setup/common_attributes.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+namespace logging = boost::log;
+
+#define QCATLOG_QUEUE_SIZE 4096
+#define QCATLOG_DEFAULT_LEVEL qll_info
+
+typedef logging::sinks::asynchronous_sink<logging::sinks::text_file_backend,
+	logging::sinks::bounded_fifo_queue<QCATLOG_QUEUE_SIZE, logging::sinks::drop_on_overflow> > QCATLogSink;
+
+static std::atomic<int> s_level(QCATLOG_DEFAULT_LEVEL);
+static std::once_flag s_initOnce;
+static boost::shared_ptr<QCATLogSink> s_sink;
+static std::atomic<bool> s_ready(false);
+
+static void stopSink()
+{
+	if(!s_ready.exchange(false))
+		return;
+	logging::core::get()->remove_sink(s_sink);
+	s_sink->stop();
+	s_sink->flush();
+}
+
+static logging::trivial::severity_level toSeverity(QCATLogLevel level)
+{
+	switch(level) {
+		case qll_trace: return logging::trivial::trace;
+		case qll_debug: return logging::trivial::debug;
+		case qll_info: return logging::trivial::info;
+		case qll_warning: return logging::trivial::warning;
+		default: return logging::trivial::error;
+	}
+}
+
+void QCATLog::init(std::string fileName)
+{
+	std::call_once(s_initOnce, [&fileName]() {
+		const char* env = getenv("QCAT_LOG_LEVEL");
+		if(env)
+			setLevel(levelFromString(env));
+
+		auto backend = boost::make_shared<logging::sinks::text_file_backend>(
+			logging::keywords::file_name = fileName,
+			logging::keywords::open_mode = std::ios_base::out | std::ios_base::app);
+		backend->auto_flush(false);
+
+		s_sink = boost::make_shared<QCATLogSink>(backend);
+		s_sink->set_formatter(logging::expressions::stream
+			<< "[" << logging::expressions::format_date_time<boost::posix_time::ptime>("TimeStamp", "%Y-%m-%d %H:%M:%S.%f")
+			<< "] <" << logging::trivial::severity << ">: " << logging::expressions::smessage);
+
+		logging::add_common_attributes();
+		logging::core::get()->add_sink(s_sink);
+		s_ready = true;
+		// the writer thread has to be drained before static destruction
+		std::atexit(stopSink);
+	});
+}
+
+void QCATLog::setLevel(QCATLogLevel level)
+{
+	s_level.store(level, std::memory_order_relaxed);
+}
+
+QCATLogLevel QCATLog::level()
+{
+	return (QCATLogLevel)s_level.load(std::memory_order_relaxed);
+}
+
+bool QCATLog::enabled(QCATLogLevel level)
+{
+	return level != qll_off && level >= s_level.load(std::memory_order_relaxed);
+}
+
+QCATLogLevel QCATLog::levelFromString(const std::string& name)
+{
+	const std::string n = boost::algorithm::to_lower_copy(boost::algorithm::trim_copy(name));
+	if(n == "trace") return qll_trace;
+	if(n == "debug") return qll_debug;
+	if(n == "warning" || n == "warn") return qll_warning;
+	if(n == "error") return qll_error;
+	if(n == "off" || n == "none") return qll_off;
+	return qll_info;
+}
+
+void QCATLog::write(QCATLogLevel level, const std::string& message)
+{
+	// without a sink boost would fall back to its synchronous console sink
+	if(!s_ready)
+		return;
+	BOOST_LOG_SEV(logging::trivial::logger::get(), toSeverity(level)) << message;
+}
+
+void QCATLog::flush()
+{
+	if(s_ready)
+		s_sink->flush();
+}
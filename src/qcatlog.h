@@ -0,0 +1,76 @@
+#ifndef QCATLOG_H
+#define QCATLOG_H
+
+#include <string>
+#include <sstream>
+
+#define QCATLOG_DEFAULT_FILE "libqcat.log"
+
+enum QCATLogLevel { qll_trace, qll_debug, qll_info, qll_warning, qll_error, qll_off };
+
+/*!
+ * \brief The process-wide libqcat log. Records go onto a bounded queue and are written to the log file by
+ * a background thread, so logging never waits on disk; when the queue is full new records are dropped.
+ * A record below the current level costs one atomic load, and nothing at all when built with QCAT_NO_LOGGING.
+ */
+class QCATLog
+{
+public:
+	/*!
+	 * \brief Adds the file sink; only the first call in a process has any effect. The level starts at
+	 * QCAT_LOG_LEVEL from the environment (trace, debug, info, warning, error or off) if it is set.
+	 */
+	static void init(std::string fileName = QCATLOG_DEFAULT_FILE);
+
+	static void setLevel(QCATLogLevel level);
+	static QCATLogLevel level();
+	static bool enabled(QCATLogLevel level);
+
+	/*!
+	 * \brief Parses a level name; unknown names give qll_info
+	 */
+	static QCATLogLevel levelFromString(const std::string& name);
+
+	static void write(QCATLogLevel level, const std::string& message);
+
+	/*!
+	 * \brief Blocks until every queued record has been written
+	 */
+	static void flush();
+};
+
+/*!
+ * \brief Collects one record and hands it to QCATLog when it goes out of scope; use through QCAT_LOG
+ */
+class QCATLogRecord
+{
+public:
+	QCATLogRecord(QCATLogLevel level) :m_level(level) {}
+	~QCATLogRecord() { QCATLog::write(m_level, m_stream.str()); }
+
+	std::ostream& stream() { return m_stream; }
+
+private:
+	QCATLogLevel m_level;
+	std::ostringstream m_stream;
+};
+
+/*!
+ * \brief Turns a streamed record into void so QCAT_LOG can be the branch of a conditional expression.
+ * & binds more loosely than << and more tightly than ?:, so the whole record is streamed first.
+ */
+class QCATLogVoidify
+{
+public:
+	void operator&(std::ostream&) {}
+};
+
+// QCAT_LOG(qll_debug) << "..."; the message is only built if the level is enabled. It is a single
+// expression, so it is safe as the body of an unbraced if/else.
+#ifdef QCAT_NO_LOGGING
+#define QCAT_LOG(level) true ? (void)0 : QCATLogVoidify() & QCATLogRecord(level).stream()
+#else
+#define QCAT_LOG(level) !QCATLog::enabled(level) ? (void)0 : QCATLogVoidify() & QCATLogRecord(level).stream()
+#endif
+
+#endif
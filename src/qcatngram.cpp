@@ -5,9 +5,9 @@
 #include "qcatcondition.h"
 #include "qcatbin.h"
 #include <numeric>
+#include <limits>
 
-#define BOOST_LOG_DYN_LINK 1
-#include <boost/log/trivial.hpp>
+#include "qcatlog.h"
 
 using namespace std::placeholders;
 
@@ -17,7 +17,7 @@ std::string QCATNGramHashAccumulator(std::string res, QCATNGramBin bin)
 }
 
 QCATNGram::QCATNGram(shared_ptr<QCATDataSource> ds)
-	:m_db(ds),m_qcat(new QCAT(ds))
+	:m_jointOverflow(false),m_db(ds),m_qcat(new QCAT(ds))
 {
 	setN(QCATNGRAM_DEFAULT_N);
 	setLetterType(qlt_absolute_value);
@@ -26,10 +26,29 @@ QCATNGram::QCATNGram(shared_ptr<QCATDataSource> ds)
 }
 
 void QCATNGram::setDependentVariable(std::string fieldname)
+{
+	setDependentVariables(std::vector<std::string>(1, fieldname));
+}
+
+void QCATNGram::setDependentVariables(std::vector<std::string> fieldnames)
 {
 	// dependent variables are just VONs
-	m_dependent = make_shared<QCATAttribute>(m_db->fieldForName(fieldname));
-	initialiseBins();
+	m_dependents.clear();
+	for(auto name: fieldnames)
+		m_dependents.push_back(make_shared<QCATAttribute>(m_db->fieldForName(name)));
+}
+
+void QCATNGram::addDependentVariable(std::string fieldname)
+{
+	m_dependents.push_back(make_shared<QCATAttribute>(m_db->fieldForName(fieldname)));
+}
+
+std::vector<std::string> QCATNGram::dependentVariables() const
+{
+	std::vector<std::string> names;
+	for(auto dep: m_dependents)
+		names.push_back(dep->name());
+	return names;
 }
 
 void QCATNGram::setIndependentVariable(std::string fieldname)
@@ -51,40 +70,143 @@ shared_ptr<QCAT> QCATNGram::qcat() const
 void QCATNGram::setN(int n)
 {
 	m_N = n;
-	initialiseBins();
 }
 
-void QCATNGram::initialiseBins()
+int QCATNGram::N() const
+{
+	return m_N;
+}
+
+void QCATNGram::initialiseBins(bool checkVersion)
 {
+	discoverRange(checkVersion);
 	discoverBinWidth();
 	setDependentBin();
 }
 
-void QCATNGram::discoverBinWidth()
+std::string QCATNGram::rangeCacheKey() const
+{
+	std::string key;
+	for(auto dep: m_dependents)
+		key += dep->sqlUnbinned() + ",";
+	return key + "|" + m_qcat->sqlConditionals();
+}
+
+void QCATNGram::discoverRange(bool checkVersion)
 {
-	if(m_dependent.get() == NULL)
+	if(m_dependents.empty())
 		return;
 
-	std::string sql = "SELECT MIN(" + m_dependent->sqlUnbinned() + ") AS _min,"
-		+ " MAX(" + m_dependent->sqlUnbinned() + ") AS _max "
-		+ " FROM " + m_db->table()
-		+ " WHERE " + m_qcat->sqlConditionals();
-	
-	QCATDBResult rows = m_db->executeSQL(sql);
+	if(checkVersion || !m_tableVersion.valid)
+		m_tableVersion = m_db->tableVersion();
+
+	// ranges only depend on the dependents, the conditionals and the table contents (not on N)
+	const std::string key = rangeCacheKey() + "|" + m_tableVersion.token();
+	auto cached = m_rangeCache.find(key);
+	if(m_tableVersion.valid && cached != m_rangeCache.end()) {
+		m_depStatsMin = cached->second.first;
+		m_depStatsMax = cached->second.second;
+		return;
+	}
+
+	const size_t K = m_dependents.size();
+	m_depStatsMin.assign(K, 0);
+	m_depStatsMax.assign(K, 0);
+
+	// with no conditionals the field stats (cached in the stats table) already hold the range
+	bool fromStats = m_qcat->conditionals().empty();
+	for(size_t k = 0; fromStats && k < K; ++k) {
+		auto fs = m_dependents[k]->field()->stats();
+		fromStats = fs.min().reliable_numeric && fs.max().reliable_numeric;
+		m_depStatsMin[k] = fs.min().numeric;
+		m_depStatsMax[k] = fs.max().numeric;
+	}
+
+	if(!fromStats) {
+		// ranges of all dependents are discovered in one scan
+		std::string sql = "SELECT ";
+		for(size_t k = 0; k < K; ++k) {
+			const std::string idx = boost::lexical_cast<std::string>(k);
+			sql += "MIN(" + m_dependents[k]->sqlUnbinned() + ") AS _min" + idx + ","
+				+ " MAX(" + m_dependents[k]->sqlUnbinned() + ") AS _max" + idx + ",";
+		}
+		sql = sql.substr(0, sql.size()-1)
+			+ " FROM " + m_db->table()
+			+ " WHERE " + m_qcat->sqlConditionals();
 	
-	m_depStatsMin = rows->getDouble(0,"_min");
-	m_depStatsMax = rows->getDouble(0,"_max");
-	m_binWidth = (m_depStatsMax - m_depStatsMin) / (double)m_N;
+		QCATDBResult rows = m_db->executeSQL(sql);
+		for(size_t k = 0; k < K; ++k) {
+			const std::string idx = boost::lexical_cast<std::string>(k);
+			m_depStatsMin[k] = rows->getDouble(0,"_min" + idx);
+			m_depStatsMax[k] = rows->getDouble(0,"_max" + idx);
+		}
+	}
+
+	if(m_tableVersion.valid) {
+		// entries for older versions can never be hit again
+		if(m_rangeCacheVersion != m_tableVersion.token())
+			m_rangeCache.clear();
+		m_rangeCacheVersion = m_tableVersion.token();
+		m_rangeCache[key] = std::make_pair(m_depStatsMin, m_depStatsMax);
+	}
+}
 
-	BOOST_LOG_TRIVIAL(info) << "QCATNGram::discoverBinWidth got bin width of " << m_binWidth << std::endl;
+void QCATNGram::discoverBinWidth()
+{
+	const size_t K = std::min(m_dependents.size(), m_depStatsMin.size());
+	m_binWidths.assign(K, 1.0);
+	m_binOffsets.assign(K, 0);
+	m_binStrides.assign(K, 1);
+
+	long long stride = 1;
+	for(size_t k = 0; k < K; ++k) {
+		m_binWidths[k] = (m_depStatsMax[k] - m_depStatsMin[k]) / (double)m_N;
+		if(m_binWidths[k] <= 0)
+			m_binWidths[k] = 1.0;
+
+		// the server rounds or truncates when binning, so leave one bin of slack either side
+		const QCATNGramBin lo = (QCATNGramBin)floor(m_depStatsMin[k] / m_binWidths[k]) - 1;
+		const QCATNGramBin hi = (QCATNGramBin)ceil(m_depStatsMax[k] / m_binWidths[k]) + 1;
+		m_binOffsets[k] = lo;
+		m_binStrides[k] = (QCATNGramBin)stride;
+		stride *= (hi - lo + 1);
+
+		QCAT_LOG(qll_debug) << "QCATNGram::discoverBinWidth got bin width of " << m_binWidths[k] 
+			<< " for " << m_dependents[k]->name();
+	}
+
+	m_jointOverflow = K > 1 && stride > std::numeric_limits<QCATNGramBin>::max();
+	if(m_jointOverflow)
+		std::cerr << "*** QCATNGram::discoverBinWidth: joint alphabet too large for key type" << std::endl;
+}
+
+std::string QCATNGram::whyCantRun() const
+{
+	if(m_dependents.empty() || !m_independent)
+		return "N-gram needs an independent and at least one dependent variable.";
+	if(m_dependents.size() > 1 && m_letterType != qlt_absolute_value)
+		return "Relative order, delta and direction letters need a single dependent variable.";
+	return "";
+}
+
+QCATNGramBin QCATNGram::jointBin(const QCATNGramDepList& bins) const
+{
+	if(bins.size() == 1)
+		return bins[0];
+
+	QCATNGramBin key = 0;
+	for(size_t k = 0; k < bins.size(); ++k)
+		key += (bins[k] - m_binOffsets[k]) * m_binStrides[k];
+	return key;
 }
 
 void QCATNGram::setDependentBin()
 {
-	if(m_dependent.get() == NULL)
+	if(m_dependents.empty())
 		return;
 
-	m_dependent->bin()->setBinWidth(m_binWidth);
+	for(size_t k = 0; k < m_dependents.size(); ++k)
+		m_dependents[k]->bin()->setBinWidth(m_binWidths[k]);
 }
 	
 void QCATNGram::setLetterType(QCATNGramLetterType type)
@@ -97,12 +219,18 @@ void QCATNGram::setLetterType(QCATNGramLetterType type)
  */
 std::string QCATNGram::sqlNGram() const
 {
-	std::string sql = "SELECT " + m_dependent->sqlSelect()		// dependent variable
-		+ ", " + m_independent->sqlUnbinned()
+	std::string deps, order;
+	for(auto dep: m_dependents) {
+		deps += dep->sqlSelect() + ", ";						// dependent variables
+		order += dep->name() + ", ";
+	}
+
+	std::string sql = "SELECT " + deps
+		+ m_independent->sqlUnbinned()
 	   	+ ", " + m_qcat->sqlVONSHashSelect()					// hash of VONs
 		+ " FROM " + m_db->table()
 		+ " WHERE " + m_qcat->sqlConditionals()					// any additional conditions (not ngram related)
-		+ " ORDER BY " + m_dependent->name() + ", hash ";	// ensures dependent variables in correct order
+		+ " ORDER BY " + order + "hash ";						// ensures dependent variables in correct order
 
 	return sql;
 }
@@ -190,24 +318,77 @@ QCATNGramLetterFunc QCATNGram::letterFunc()
 
 QCATNGramResult QCATNGram::executeNGram() 
 {
+	const std::string error = whyCantRun();
+	if(!error.empty()) {
+		QCATNGramResult result;
+		result.qcatsummary = QCATSummary(error);
+		return result;
+	}
+
+	initialiseBins(true);
+	return run();
+}
+
+std::map<int,QCATNGramResult> QCATNGram::executeNGramSweep(std::vector<int> ns)
+{
+	std::map<int,QCATNGramResult> results;
+	const int originalN = m_N;
+
+	const std::string error = whyCantRun();
+	if(!error.empty()) {
+		for(int n: ns)
+			results[n].qcatsummary = QCATSummary(error);
+		return results;
+	}
+
+	// check the table version once; every N then reuses the same cached range
+	discoverRange(true);
+	for(int n: ns) {
+		m_N = n;
+		initialiseBins(false);
+		results[n] = run();
+	}
+
+	m_N = originalN;
+	return results;
+}
+
+std::map<int,QCATNGramResult> QCATNGram::executeNGramSweep(int from, int to)
+{
+	std::vector<int> ns;
+	for(int n = from; n <= to; ++n)
+		ns.push_back(n);
+	return executeNGramSweep(ns);
+}
+
+QCATNGramResult QCATNGram::run()
+{
+	if(m_jointOverflow) {
+		QCATNGramResult result;
+		result.qcatsummary = QCATSummary("Joint alphabet of the dependent variables is too large at this N.");
+		return result;
+	}
+
 	// set up hashtable of T => list of dependents (which is actually the letter hash)
 	QCATNGramTimeToDep timeToDeps;
 
     // get all rows from DB matching conditionals
-	initialiseBins();
     const std::string sql = this->sqlNGram();
     QCATDBResult rows = m_db->executeSQL(sql);
     int totalRows = 0;
 
-	const int depCol = rows->colForName(m_dependent->name());
+	std::vector<int> depCols;
+	for(auto dep: m_dependents)
+		depCols.push_back(rows->colForName(dep->name()));
 	const int indepCol = rows->colForName(m_independent->name());
 
-    // compile hashtable of time => list of dependent variables
+	// compile hashtable of time => list of (joint) dependent variables
+	QCATNGramDepList bins(depCols.size());
 	for(int i=0;i<rows->nrows();i++) {
-        std::string hash(rows->get(i,"hash"));
 		const QCATNGramTime t = rows->getInt(i,indepCol);
-		const QCATNGramBin b = rows->getInt(i,depCol);
-		timeToDeps[t].push_back(b);
+		for(size_t k = 0; k < depCols.size(); ++k)
+			bins[k] = rows->getInt(i,depCols[k]);
+		timeToDeps[t].push_back(jointBin(bins));
         totalRows++;
     }
 
@@ -233,6 +414,7 @@ QCATNGramResult QCATNGram::executeNGram()
 
     // compile results struct
     QCATSummary summary;
+	summary.success = true;
     summary.message = "Successfully run QCAT.";
     summary.entropy = HZ;
     summary.surprise_mean = totalSurprise / (float)Z.size();
@@ -6,6 +6,7 @@
 using namespace std;
 
 #include "qcat.h"
+#include "qcatdatasource.h"
 #include <functional>
 
 class QCATCondition;
@@ -59,8 +60,22 @@ public:
     QCATNGram(shared_ptr<QCATDataSource>);
 
 	void setIndependentVariable(std::string);
+
+	/*!
+	 * \brief Sets a single dependent variable, replacing any existing ones
+	 */
 	void setDependentVariable(std::string);
+
+	/*!
+	 * \brief Sets several dependent variables whose joint behaviour forms each letter. All are
+	 * fetched in the same scan and share the independent (time) grouping.
+	 */
+	void setDependentVariables(std::vector<std::string>);
+	void addDependentVariable(std::string);
+	std::vector<std::string> dependentVariables() const;
+
 	void setN(int);
+	int N() const;
 	void setLetterType(QCATNGramLetterType);
 
 	void setQCAT(shared_ptr<QCAT> qcat);
@@ -68,12 +83,42 @@ public:
 
 	QCATNGramResult executeNGram();
 
+	/*!
+	 * \brief Runs the n-gram for each of the given N. The dependent ranges are discovered (or taken from
+	 * the cache) once and reused, since only the bin width changes with N.
+	 * \return Map of N to result
+	 */
+	std::map<int,QCATNGramResult> executeNGramSweep(std::vector<int> ns);
+	std::map<int,QCATNGramResult> executeNGramSweep(int from, int to);
+
 private:
 
 	void setDependentBin();
 	void discoverBinWidth();
 
-	void initialiseBins();
+	/*!
+	 * \brief Finds the MIN/MAX of each dependent under the current conditionals. Ranges are cached
+	 * against the dependents, the conditionals and the table version token; with no conditionals the
+	 * field stats are used instead of scanning.
+	 * \param checkVersion If false, trusts the last table version seen rather than querying it again
+	 */
+	void discoverRange(bool checkVersion = true);
+	std::string rangeCacheKey() const;
+
+	void initialiseBins(bool checkVersion = true);
+	QCATNGramResult run();
+
+	/*!
+	 * \brief Why the n-gram can't be run as configured, or empty if it can. Relative order, delta and
+	 * direction letters compare dependents' values, which a joint key of several dependents doesn't preserve.
+	 */
+	std::string whyCantRun() const;
+
+	/*!
+	 * \brief Combines the bins of all dependents on a row into one compact (mixed radix) key.
+	 * With a single dependent the bin is used as-is.
+	 */
+	QCATNGramBin jointBin(const QCATNGramDepList& bins) const;
 
 	QCATNGramZ buildAbsoluteZ(QCATNGramTimeToDep&);
 	QCATNGramZ buildRelativeZ(QCATNGramTimeToDep&);
@@ -83,11 +128,19 @@ private:
 
     QCATNGramLetterType m_letterType;
 	shared_ptr<QCATAttribute> m_independent;
-	shared_ptr<QCATAttribute> m_dependent;
+	std::vector<shared_ptr<QCATAttribute> > m_dependents;
 	int m_N;
 	
-	double m_depStatsMin, m_depStatsMax;
-	double m_binWidth;
+	// per-dependent range, bin width and joint key layout
+	std::vector<double> m_depStatsMin, m_depStatsMax;
+	std::vector<double> m_binWidths;
+	std::vector<QCATNGramBin> m_binOffsets, m_binStrides;
+	bool m_jointOverflow;	// the joint alphabet doesn't fit QCATNGramBin, so keys would collide
+
+	// dependent ranges keyed by rangeCacheKey() and table version
+	std::map<std::string,std::pair<std::vector<double>,std::vector<double> > > m_rangeCache;
+	std::string m_rangeCacheVersion;
+	QCATTableVersion m_tableVersion;
 
 	QCATNGramLetterFunc letterFunc();
 
@@ -0,0 +1,146 @@
+#include "qcatplan.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/format.hpp>
+
+using boost::property_tree::ptree;
+
+QCATPlan::QCATPlan()
+	:m_planningTime(0), m_executionTime(0)
+{
+}
+
+std::string QCATPlan::explainSQL(const std::string& sql)
+{
+	return "EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) " + sql;
+}
+
+static void addNodes(const ptree& plan, int depth, int parent, std::vector<QCATPlanNode>* nodes)
+{
+	QCATPlanNode node;
+	node.node_type = plan.get<std::string>("Node Type", "");
+	node.relation = plan.get<std::string>("Relation Name", "");
+	node.index_name = plan.get<std::string>("Index Name", "");
+	node.depth = depth;
+	node.parent = parent;
+	node.startup_cost = plan.get<double>("Startup Cost", 0);
+	node.total_cost = plan.get<double>("Total Cost", 0);
+	node.plan_rows = plan.get<long>("Plan Rows", 0);
+	node.actual_rows = plan.get<long>("Actual Rows", 0);
+	node.loops = plan.get<long>("Actual Loops", 0);
+	node.actual_startup_time = plan.get<double>("Actual Startup Time", 0);
+	node.actual_total_time = plan.get<double>("Actual Total Time", 0);
+	node.shared_hit = plan.get<long>("Shared Hit Blocks", 0);
+	node.shared_read = plan.get<long>("Shared Read Blocks", 0);
+	node.shared_dirtied = plan.get<long>("Shared Dirtied Blocks", 0);
+	node.shared_written = plan.get<long>("Shared Written Blocks", 0);
+	node.temp_read = plan.get<long>("Temp Read Blocks", 0);
+	node.temp_written = plan.get<long>("Temp Written Blocks", 0);
+
+	const int index = nodes->size();
+	nodes->push_back(node);
+
+	double childTime = 0;
+	auto children = plan.get_child_optional("Plans");
+	if(children) {
+		for(auto& child: *children) {
+			const size_t first = nodes->size();
+			addNodes(child.second, depth + 1, index, nodes);
+			childTime += (*nodes)[first].actual_total_time * (*nodes)[first].loops;
+		}
+	}
+
+	QCATPlanNode& added = (*nodes)[index];
+	added.self_time = std::max(0.0, added.actual_total_time * added.loops - childTime);
+}
+
+QCATPlan QCATPlan::fromJSON(const std::string& json, bool* success)
+{
+	QCATPlan result;
+	if(success)
+		*success = false;
+
+	ptree root;
+	try {
+		std::istringstream in(json);
+		boost::property_tree::read_json(in, root);
+	}
+	catch(const boost::property_tree::json_parser_error& e) {
+		std::cerr << "*** QCATPlan could not parse EXPLAIN output: " << e.what() << std::endl;
+		return result;
+	}
+
+	// EXPLAIN returns an array holding a single object
+	if(root.empty())
+		return result;
+	const ptree& top = root.front().second;
+	auto plan = top.get_child_optional("Plan");
+	if(!plan)
+		return result;
+
+	addNodes(*plan, 0, -1, &result.m_nodes);
+	result.m_planningTime = top.get<double>("Planning Time", 0);
+	result.m_executionTime = top.get<double>("Execution Time", 0);
+
+	if(success)
+		*success = true;
+	return result;
+}
+
+const std::vector<QCATPlanNode>& QCATPlan::nodes() const
+{
+	return m_nodes;
+}
+
+double QCATPlan::planningTime() const
+{
+	return m_planningTime;
+}
+
+double QCATPlan::executionTime() const
+{
+	return m_executionTime;
+}
+
+const QCATPlanNode* QCATPlan::hottestNode() const
+{
+	const QCATPlanNode* hottest = NULL;
+	for(auto& node: m_nodes) {
+		if(!hottest || node.self_time > hottest->self_time)
+			hottest = &node;
+	}
+	return hottest;
+}
+
+std::vector<std::string> QCATPlan::seqScannedRelations() const
+{
+	std::vector<std::string> relations;
+	for(auto& node: m_nodes) {
+		if(node.isSeqScan() && std::find(relations.begin(), relations.end(), node.relation) == relations.end())
+			relations.push_back(node.relation);
+	}
+	return relations;
+}
+
+std::string QCATPlan::toString() const
+{
+	std::stringstream ss;
+	for(auto& node: m_nodes) {
+		ss << std::string(node.depth * 2, ' ') << (node.depth ? "-> " : "") << node.node_type;
+		if(!node.relation.empty())
+			ss << " on " << node.relation;
+		if(!node.index_name.empty())
+			ss << " using " << node.index_name;
+		ss << boost::format(" (rows=%d/%d est, loops=%d, time=%.3f ms, self=%.3f ms, shared hit=%d read=%d")
+			% node.actual_rows % node.plan_rows % node.loops % node.actual_total_time % node.self_time
+			% node.shared_hit % node.shared_read;
+		if(node.temp_read || node.temp_written)
+			ss << boost::format(", temp read=%d written=%d") % node.temp_read % node.temp_written;
+		ss << ")" << std::endl;
+	}
+	ss << boost::format("Planning %.3f ms, execution %.3f ms") % m_planningTime % m_executionTime << std::endl;
+	return ss.str();
+}
@@ -0,0 +1,89 @@
+#ifndef QCATPLAN_H
+#define QCATPLAN_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+/*!
+ * \brief One node of an executed query plan. Times are in milliseconds and, like Postgres, per loop;
+ * self_time is the node's own time over all its loops, excluding its children
+ */
+struct QCATPlanNode
+{
+	QCATPlanNode() {
+		depth = 0;
+		parent = -1;
+		startup_cost = total_cost = 0;
+		plan_rows = actual_rows = loops = 0;
+		actual_startup_time = actual_total_time = self_time = 0;
+		shared_hit = shared_read = shared_dirtied = shared_written = temp_read = temp_written = 0;
+	}
+
+	std::string node_type;
+	std::string relation;		// empty for nodes that don't read a relation
+	std::string index_name;
+	int depth;
+	int parent;					// index into QCATPlan::nodes(), -1 for the root
+
+	double startup_cost, total_cost;
+	long plan_rows, actual_rows, loops;
+	double actual_startup_time, actual_total_time, self_time;
+
+	// buffer blocks, including those of the children
+	long shared_hit, shared_read, shared_dirtied, shared_written, temp_read, temp_written;
+
+	bool isSeqScan() const {
+		return node_type == "Seq Scan";
+	}
+};
+
+/*!
+ * \brief The plan of a query as run by EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON), flattened depth first
+ */
+class QCATPlan
+{
+public:
+	QCATPlan();
+
+	/*!
+	 * \brief Wraps sql so that running it returns its executed plan
+	 */
+	static std::string explainSQL(const std::string& sql);
+
+	/*!
+	 * \brief Parses the JSON EXPLAIN returns
+	 * \param success Set to whether the JSON held a plan
+	 */
+	static QCATPlan fromJSON(const std::string& json, bool* success = NULL);
+
+	const std::vector<QCATPlanNode>& nodes() const;
+
+	double planningTime() const;
+	double executionTime() const;
+
+	/*!
+	 * \brief The node that spent the most time itself, or NULL for an empty plan
+	 */
+	const QCATPlanNode* hottestNode() const;
+
+	/*!
+	 * \brief Relations read by sequential scans; where a missing index usually shows up
+	 */
+	std::vector<std::string> seqScannedRelations() const;
+
+	/*!
+	 * \brief An indented tree of the nodes with rows, times and buffers, like EXPLAIN's text format
+	 */
+	std::string toString() const;
+
+	friend std::ostream& operator<<(std::ostream &strm, const QCATPlan &p) {
+		return strm << p.toString();
+	}
+
+private:
+	std::vector<QCATPlanNode> m_nodes;
+	double m_planningTime, m_executionTime;
+};
+
+#endif
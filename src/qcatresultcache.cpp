@@ -0,0 +1,220 @@
+#include "qcatresultcache.h"
+#include "qcatdatasource.h"
+#include <fstream>
+#include <sstream>
+#include <boost/functional/hash.hpp>
+
+#define RESULT_CACHE_FORMAT "QCATSUMMARY 1"
+
+QCATResultCache::QCATResultCache()
+	:m_versionInterval(5), m_versionCheckedAt(0), m_maxEntries(1024)
+{
+}
+
+void QCATResultCache::setDirectory(std::string dir)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_dir = dir;
+}
+
+std::string QCATResultCache::directory() const
+{
+	return m_dir;
+}
+
+void QCATResultCache::setVersionCheckInterval(double seconds)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_versionInterval = seconds;
+}
+
+void QCATResultCache::setMaxEntries(size_t entries)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_maxEntries = entries;
+	evict();
+}
+
+size_t QCATResultCache::maxEntries() const
+{
+	return m_maxEntries;
+}
+
+std::string QCATResultCache::version(const QCATDataSource* db)
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		if(!m_version.empty() && difftime(time(NULL), m_versionCheckedAt) < m_versionInterval)
+			return m_version;
+	}
+
+	auto v = db->tableVersion();
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_version = v.valid ? v.token() : "";
+	m_versionCheckedAt = time(NULL);
+	return m_version;
+}
+
+template<class T>
+bool QCATResultCache::lookup(const std::map<std::string,std::pair<std::string,T> >& m, const std::string& key, const std::string& version, T* out)
+{
+	auto it = m.find(key);
+	if(it == m.end() || it->second.first != version)
+		return false;
+	*out = it->second.second;
+	return true;
+}
+
+void QCATResultCache::touch(char kind, const std::string& key)
+{
+	const std::string name = kind + key;
+	auto it = m_lruPos.find(name);
+	if(it != m_lruPos.end())
+		m_lru.erase(it->second);
+	m_lru.push_front(name);
+	m_lruPos[name] = m_lru.begin();
+}
+
+void QCATResultCache::evict()
+{
+	while(m_lru.size() > m_maxEntries) {
+		const std::string name = m_lru.back();
+		const std::string key = name.substr(1);
+		if(name[0] == 's')
+			m_summaries.erase(key);
+		else if(name[0] == 'r')
+			m_records.erase(key);
+		else
+			m_surprisals.erase(key);
+		m_lruPos.erase(name);
+		m_lru.pop_back();
+	}
+}
+
+bool QCATResultCache::getSummary(const std::string& key, const std::string& version, QCATSummary* out)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	if(lookup(m_summaries, key, version, out)) {
+		touch('s', key);
+		return true;
+	}
+
+	if(persistable(key) && loadSummary(key, version, out)) {
+		m_summaries[key] = std::make_pair(version, *out);
+		touch('s', key);
+		evict();
+		return true;
+	}
+	return false;
+}
+
+void QCATResultCache::putSummary(const std::string& key, const std::string& version, const QCATSummary& summary)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_summaries[key] = std::make_pair(version, summary);
+	touch('s', key);
+	evict();
+	if(persistable(key))
+		saveSummary(key, version, summary);
+}
+
+bool QCATResultCache::getRecords(const std::string& key, const std::string& version, std::vector<QCATRecord>* out)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	if(!lookup(m_records, key, version, out))
+		return false;
+	touch('r', key);
+	return true;
+}
+
+void QCATResultCache::putRecords(const std::string& key, const std::string& version, const std::vector<QCATRecord>& records)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_records[key] = std::make_pair(version, records);
+	touch('r', key);
+	evict();
+}
+
+bool QCATResultCache::getSurprisals(const std::string& key, const std::string& version, QCATSummaryAndSurprisals* out)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	if(!lookup(m_surprisals, key, version, out))
+		return false;
+	touch('p', key);
+	return true;
+}
+
+void QCATResultCache::putSurprisals(const std::string& key, const std::string& version, const QCATSummaryAndSurprisals& result)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_surprisals[key] = std::make_pair(version, result);
+	touch('p', key);
+	evict();
+}
+
+void QCATResultCache::clear()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_summaries.clear();
+	m_records.clear();
+	m_surprisals.clear();
+	m_lru.clear();
+	m_lruPos.clear();
+	m_version.clear();
+}
+
+bool QCATResultCache::persistable(const std::string& key) const
+{
+	// entries are stored line by line, so keys must fit on one line
+	return !m_dir.empty() && key.find('\n') == std::string::npos;
+}
+
+std::string QCATResultCache::pathForKey(const std::string& key) const
+{
+	std::stringstream ss;
+	ss << m_dir << "/qcat_" << std::hex << boost::hash<std::string>()(key) << ".summary";
+	return ss.str();
+}
+
+bool QCATResultCache::loadSummary(const std::string& key, const std::string& version, QCATSummary* out) const
+{
+	std::ifstream in(pathForKey(key).c_str());
+	if(!in)
+		return false;
+
+	// the full key is stored so that hash collisions are never returned
+	std::string format, storedKey, storedVersion;
+	std::getline(in, format);
+	std::getline(in, storedKey);
+	std::getline(in, storedVersion);
+	if(format != RESULT_CACHE_FORMAT || storedKey != key || storedVersion != version)
+		return false;
+
+	QCATSummary s;
+	in >> s.entropy >> s.surprise_mean >> s.surprise_stddev >> s.uncertainty 
+		>> s.alphabet_size >> s.record_length >> s.wall_time >> s.success;
+	in.ignore();
+	std::getline(in, s.qcatid);
+	std::getline(in, s.message);
+	std::getline(in, s.sql_used);
+	if(in.fail())
+		return false;
+
+	*out = s;
+	return true;
+}
+
+void QCATResultCache::saveSummary(const std::string& key, const std::string& version, const QCATSummary& s) const
+{
+	std::ofstream out(pathForKey(key).c_str());
+	if(!out) {
+		std::cerr << "*** QCATResultCache: unable to write to " << m_dir << std::endl;
+		return;
+	}
+
+	out.precision(9);
+	out << RESULT_CACHE_FORMAT << "\n" << key << "\n" << version << "\n"
+		<< s.entropy << " " << s.surprise_mean << " " << s.surprise_stddev << " " << s.uncertainty << " "
+		<< s.alphabet_size << " " << s.record_length << " " << s.wall_time << " " << s.success << "\n"
+		<< s.qcatid << "\n" << s.message << "\n" << s.sql_used << "\n";
+}
@@ -0,0 +1,86 @@
+#ifndef QCATRESULTCACHE_H
+#define QCATRESULTCACHE_H
+
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include <ctime>
+#include <boost/thread/mutex.hpp>
+#include "qcat.h"
+
+/*!
+ * \brief Caches QCAT results keyed by their canonical SQL, valid for as long as the table version token
+ * (see QCATDataSource::tableVersion) is unchanged. Summaries can optionally be persisted to a directory so
+ * they survive between processes; top-N and surprisal results are kept in memory only. The in-memory
+ * entries are bounded: once there are more than maxEntries() the least recently used are evicted.
+ */
+class QCATResultCache
+{
+public:
+	QCATResultCache();
+
+	/*!
+	 * \brief Enables the on-disk cache for summaries in the given directory (empty disables it)
+	 */
+	void setDirectory(std::string dir);
+	std::string directory() const;
+
+	/*!
+	 * \brief How long a table version token is trusted before it is queried again (default 5 seconds; 0
+	 * queries it on every lookup)
+	 */
+	void setVersionCheckInterval(double seconds);
+
+	/*!
+	 * \brief The most in-memory entries (summaries, records and surprisals together) kept before the least
+	 * recently used are evicted (default 1024)
+	 */
+	void setMaxEntries(size_t entries);
+	size_t maxEntries() const;
+
+	/*!
+	 * \return The current version token of the data source's table, or empty if it can't be determined (no caching)
+	 */
+	std::string version(const QCATDataSource* db);
+
+	bool getSummary(const std::string& key, const std::string& version, QCATSummary* out);
+	void putSummary(const std::string& key, const std::string& version, const QCATSummary& summary);
+
+	bool getRecords(const std::string& key, const std::string& version, std::vector<QCATRecord>* out);
+	void putRecords(const std::string& key, const std::string& version, const std::vector<QCATRecord>& records);
+
+	bool getSurprisals(const std::string& key, const std::string& version, QCATSummaryAndSurprisals* out);
+	void putSurprisals(const std::string& key, const std::string& version, const QCATSummaryAndSurprisals& result);
+
+	void clear();
+
+private:
+	bool persistable(const std::string& key) const;
+	std::string pathForKey(const std::string& key) const;
+	bool loadSummary(const std::string& key, const std::string& version, QCATSummary* out) const;
+	void saveSummary(const std::string& key, const std::string& version, const QCATSummary& summary) const;
+
+	template<class T>
+	static bool lookup(const std::map<std::string,std::pair<std::string,T> >& m, const std::string& key, const std::string& version, T* out);
+
+	// LRU bookkeeping; entries are named by a kind prefix ('s', 'r' or 'p') and their key
+	void touch(char kind, const std::string& key);
+	void evict();
+
+	boost::mutex m_mutex;
+	std::string m_dir;
+	double m_versionInterval;
+	std::string m_version;
+	time_t m_versionCheckedAt;
+
+	std::map<std::string,std::pair<std::string,QCATSummary> > m_summaries;
+	std::map<std::string,std::pair<std::string,std::vector<QCATRecord> > > m_records;
+	std::map<std::string,std::pair<std::string,QCATSummaryAndSurprisals> > m_surprisals;
+
+	size_t m_maxEntries;
+	std::list<std::string> m_lru;		// most recently used first
+	std::map<std::string,std::list<std::string>::iterator> m_lruPos;
+};
+
+#endif // QCATRESULTCACHE_H
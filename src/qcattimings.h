@@ -0,0 +1,68 @@
+#ifndef QCATTIMINGS_H
+#define QCATTIMINGS_H
+
+#include <string>
+#include <stddef.h>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+/*!
+ * \brief Where the time of a QCAT run went, in seconds, and how much data it moved. Phases a path
+ * doesn't have (e.g. letter counting for server runs) stay at zero.
+ */
+struct QCATQueryTimings
+{
+	QCATQueryTimings() {
+		init();
+	}
+
+	void init() {
+		sql_generation = server_execution = transfer = decoding = counting = entropy = 0;
+		rows = bytes = 0;
+		peak_letter_memory = 0;
+	}
+
+	double sql_generation;		// building the SQL
+	double server_execution;	// from sending the query until the first result bytes arrive
+	double transfer;			// from the first result bytes until the result is complete
+	double decoding;			// reading values out of the result, where that is a pass of its own
+	double counting;			// counting letters into the letter table (including decoding them, for QCAT runs)
+	double entropy;				// entropy and surprise from the counts
+
+	long rows;					// rows received
+	long bytes;					// bytes of values received
+	size_t peak_letter_memory;	// estimated peak size of the letter table in bytes
+
+	double total() const {
+		return sql_generation + server_execution + transfer + decoding + counting + entropy;
+	}
+
+	/*!
+	 * \brief Adds the timings of a further query of the same run
+	 */
+	void add(const QCATQueryTimings& other) {
+		sql_generation += other.sql_generation;
+		server_execution += other.server_execution;
+		transfer += other.transfer;
+		decoding += other.decoding;
+		counting += other.counting;
+		entropy += other.entropy;
+		rows += other.rows;
+		bytes += other.bytes;
+		peak_letter_memory = std::max(peak_letter_memory, other.peak_letter_memory);
+	}
+
+	std::string toString() const {
+		return "SQL " + boost::lexical_cast<std::string>(sql_generation) +
+			"s, server " + boost::lexical_cast<std::string>(server_execution) +
+			"s, transfer " + boost::lexical_cast<std::string>(transfer) +
+			"s, decoding " + boost::lexical_cast<std::string>(decoding) +
+			"s, counting " + boost::lexical_cast<std::string>(counting) +
+			"s, entropy " + boost::lexical_cast<std::string>(entropy) +
+			"s; " + boost::lexical_cast<std::string>(rows) + " rows, " + 
+			boost::lexical_cast<std::string>(bytes) + " bytes, letter table " +
+			boost::lexical_cast<std::string>(peak_letter_memory) + " bytes";
+	}
+};
+
+#endif // QCATTIMINGS_H
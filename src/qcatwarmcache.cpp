@@ -0,0 +1,128 @@
+#include "qcatwarmcache.h"
+#include "qcatdatasource.h"
+#include "qcatfieldmanager.h"
+#include "qcatfieldstats.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/functional/hash.hpp>
+
+#define WARM_CACHE_FORMAT "QCATWARM 1"
+
+QCATWarmCache::QCATWarmCache(std::string dir, std::string connStr, std::string table)
+{
+	// the connection string may hold credentials, so only its hash goes into the file name
+	std::stringstream ss;
+	ss << dir << "/qcat_warm_" << std::hex << boost::hash<std::string>()(connStr + "|" + table) << ".cache";
+	m_path = ss.str();
+}
+
+std::string QCATWarmCache::path() const
+{
+	return m_path;
+}
+
+std::shared_ptr<QCATFieldManager> QCATWarmCache::restore(QCATDataSource* db, const std::string& fingerprint, const std::string& version) const
+{
+	std::ifstream in(m_path.c_str());
+	if(!in || fingerprint.empty())
+		return std::shared_ptr<QCATFieldManager>();
+
+	std::string format, storedFingerprint, storedVersion;
+	std::getline(in, format);
+	std::getline(in, storedFingerprint);
+	std::getline(in, storedVersion);
+	if(format != WARM_CACHE_FORMAT || storedFingerprint != fingerprint)
+		return std::shared_ptr<QCATFieldManager>();
+
+	const bool statsValid = !version.empty() && storedVersion == version;
+	auto fields = std::shared_ptr<QCATFieldManager>(new QCATFieldManager());
+
+	// one line per field: name, index, type, then optionally avg, min, max, stddev, unique, special
+	std::string line;
+	while(std::getline(in, line)) {
+		std::vector<std::string> cols;
+		boost::split(cols, line, boost::is_any_of("\t"));
+		if(cols.size() < 3)
+			return std::shared_ptr<QCATFieldManager>();
+
+		try {
+			auto field = shared_ptr<QCATField>(new QCATField(db, unescape(cols[0]), 
+				boost::lexical_cast<int>(cols[1]), (QCATFieldType)boost::lexical_cast<int>(cols[2])));
+			if(statsValid && cols.size() == 9) {
+				field->setStats(shared_ptr<QCATFieldStats>(new QCATFieldStats(field.get(), unescape(cols[3]), unescape(cols[4]), 
+					unescape(cols[5]), unescape(cols[6]), boost::lexical_cast<long>(cols[7]), unescape(cols[8]))));
+			}
+			fields->add(field);
+		}
+		catch(boost::bad_lexical_cast e) {
+			std::cerr << "*** QCATWarmCache: ignoring corrupt cache file " << m_path << std::endl;
+			return std::shared_ptr<QCATFieldManager>();
+		}
+	}
+
+	if(fields->size() == 0)
+		return std::shared_ptr<QCATFieldManager>();
+	return fields;
+}
+
+void QCATWarmCache::save(const QCATFieldManager* fields, const std::string& fingerprint, const std::string& version) const
+{
+	if(fingerprint.empty())
+		return;
+
+	// write to a temporary file and rename so that concurrent workers never read half a file
+	const std::string tmp = m_path + "." + boost::lexical_cast<std::string>(getpid());
+	{
+		std::ofstream out(tmp.c_str());
+		if(!out) {
+			std::cerr << "*** QCATWarmCache: unable to write " << tmp << std::endl;
+			return;
+		}
+
+		out << WARM_CACHE_FORMAT << "\n" << fingerprint << "\n" << version << "\n";
+		for(auto field: fields->vector()) {
+			out << escape(field->name()) << "\t" << field->index() << "\t" << (int)field->type();
+			// estimates aren't kept: they'd come back looking exact
+			if(field->hasStats() && !field->stats().approximate()) {
+				auto s = field->stats();
+				out << "\t" << escape(s.avg().text) << "\t" << escape(s.min().text) << "\t" << escape(s.max().text)
+					<< "\t" << escape(s.stddev().text) << "\t" << s.unique() << "\t" << escape(s.special());
+			}
+			out << "\n";
+		}
+	}
+	std::rename(tmp.c_str(), m_path.c_str());
+}
+
+std::string QCATWarmCache::escape(const std::string& str)
+{
+	std::string out;
+	for(char c: str) {
+		switch(c) {
+			case '\\': out += "\\\\"; break;
+			case '\t': out += "\\t"; break;
+			case '\n': out += "\\n"; break;
+			default: out += c;
+		}
+	}
+	return out;
+}
+
+std::string QCATWarmCache::unescape(const std::string& str)
+{
+	std::string out;
+	for(size_t i = 0; i < str.size(); ++i) {
+		if(str[i] == '\\' && i + 1 < str.size()) {
+			++i;
+			out += str[i] == 't' ? '\t' : str[i] == 'n' ? '\n' : str[i];
+		}
+		else
+			out += str[i];
+	}
+	return out;
+}
@@ -0,0 +1,41 @@
+#ifndef QCATWARMCACHE_H
+#define QCATWARMCACHE_H
+
+#include <string>
+#include <memory>
+
+class QCATDataSource;
+class QCATFieldManager;
+
+/*!
+ * \brief A local file holding a table's field definitions and stats, so that a QCATDataSource can start
+ * without scanning information_schema or the stats table. Files are keyed by connection string and table;
+ * they are only used while the schema fingerprint (from pg_class/pg_attribute) matches, and their stats
+ * only while the table version matches too.
+ */
+class QCATWarmCache
+{
+public:
+	QCATWarmCache(std::string dir, std::string connStr, std::string table);
+
+	/*!
+	 * \brief Rebuilds the fields from the cache file, with their stats if the table version still matches
+	 * \return The fields, or NULL if there is no file matching the fingerprint
+	 */
+	std::shared_ptr<QCATFieldManager> restore(QCATDataSource* db, const std::string& fingerprint, const std::string& version) const;
+
+	/*!
+	 * \brief Writes the fields, and any stats they have compiled, to the cache file
+	 */
+	void save(const QCATFieldManager* fields, const std::string& fingerprint, const std::string& version) const;
+
+	std::string path() const;
+
+private:
+	static std::string escape(const std::string& str);
+	static std::string unescape(const std::string& str);
+
+	std::string m_path;
+};
+
+#endif // QCATWARMCACHE_H
@@ -0,0 +1,428 @@
+#include <iostream>
+#include "../qcatdatasource.h"
+#include "../qcat.h"
+#include "../qcatngram.h"
+#include "datagen.h"
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/timer/timer.hpp>
+#include <boost/format.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <functional>
+#include <fstream>
+#include <sys/resource.h>
+
+using namespace std;
+
+#define DEFAULT_CONNSTR "dbname=qcat_bench"
+#define DEFAULT_SIZES "10000,100000,1000000"
+#define DEFAULT_SEED 42
+#define CONDITION_VALUE "cat_a_0"
+#define DEFAULT_BASELINE "tests/bench_baseline.json"
+
+struct QCATBenchResult
+{
+	QCATBenchResult()
+		:rows(0), seconds(0), entropy(0), surprise(0), peak_rss_kb(0), success(false) {}
+
+	std::string op;
+	long rows;
+	double seconds;
+	double entropy;
+	double surprise;
+	long peak_rss_kb;
+	bool success;
+
+	double rowsPerSecond() const {
+		return seconds > 0 ? rows / seconds : 0;
+	}
+};
+
+/*
+ * How far a regression run may drift from the baseline before it fails; throughput and memory
+ * are fractions of the baseline value, entropy and surprise are absolute
+ */
+struct QCATBenchTolerance
+{
+	QCATBenchTolerance()
+		:throughput(0.3), memory(0.2), entropy(0.001), surprise(0.001), min_seconds(0.05) {}
+
+	double throughput;
+	double memory;
+	double entropy;
+	double surprise;
+	double min_seconds; // throughput of faster operations is too noisy to gate on
+};
+
+/*
+ * Resets the peak resident set size so the next peak_rss_kb() covers only what runs in between
+ * (Linux 4.0+; elsewhere the peak stays process-wide)
+ */
+void reset_peak_rss()
+{
+	std::ofstream clear("/proc/self/clear_refs");
+	clear << "5";
+}
+
+/*
+ * Peak resident set size since the last reset_peak_rss(), from VmHWM; falls back to the process-wide
+ * ru_maxrss where /proc is unavailable
+ */
+long peak_rss_kb()
+{
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while(std::getline(status, line)) {
+		if(boost::starts_with(line, "VmHWM:"))
+			return boost::lexical_cast<long>(boost::trim_copy(line.substr(6, line.size() - 6 - 3)));
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/*
+ * The benchmark table: skewed categoricals, a skewed integer, a uniform double, a flag and a time column
+ */
+QCATBenchTableSpec bench_table(long rows, uint32_t seed)
+{
+	QCATBenchTableSpec spec;
+	spec.name = "qcat_bench_" + boost::lexical_cast<std::string>(rows);
+	spec.rows = rows;
+	spec.seed = seed;
+	spec.columns.push_back(QCATBenchColumn("cat_a", bct_string, 8, 1.0));
+	spec.columns.push_back(QCATBenchColumn("cat_b", bct_string, 50, 0.8));
+	spec.columns.push_back(QCATBenchColumn("num_i", bct_integer, 1000, 1.2));
+	spec.columns.push_back(QCATBenchColumn("num_d", bct_double, 5000, 0));
+	spec.columns.push_back(QCATBenchColumn("flag", bct_boolean, 2, 0.5));
+	spec.columns.push_back(QCATBenchColumn("ts", bct_timestamp, 0, 0, 60));
+	return spec;
+}
+
+QCAT bench_qcat(shared_ptr<QCATDataSource> db)
+{
+	QCATSpec spec("Benchmark QCAT");
+	spec.add("cat_a", ffr_cond);
+	spec.add("cat_b", ffr_von);
+	spec.add("num_i", ffr_von);
+	QCAT q(spec, db);
+	q.fixConditional("cat_a", CONDITION_VALUE);
+	return q;
+}
+
+/*
+ * serverRun needs the qcat_server function installed in the benchmark database; it isn't created by the benchmark
+ */
+bool server_function_available(shared_ptr<QCATDataSource> db)
+{
+	const std::string n = db->executeSQLSingleShot("SELECT count(*) FROM pg_proc WHERE proname = 'qcat_server'");
+	return !n.empty() && n != "0";
+}
+
+QCATBenchResult measure(std::string op, long rows, std::function<bool(QCATBenchResult*)> run)
+{
+	QCATBenchResult result;
+	result.op = op;
+	result.rows = rows;
+
+	reset_peak_rss();
+	boost::timer::cpu_timer timer;
+	result.success = run(&result);
+	result.seconds = timer.elapsed().wall / 1e9;
+	result.peak_rss_kb = peak_rss_kb();
+	return result;
+}
+
+std::vector<QCATBenchResult> run_benchmarks(std::string connStr, long rows, uint32_t seed)
+{
+	std::vector<QCATBenchResult> results;
+
+	QCATDataGenerator gen(bench_table(rows, seed));
+	reset_peak_rss();
+	boost::timer::cpu_timer loadTimer;
+	if(!gen.load(connStr))
+		return results;
+
+	QCATBenchResult load;
+	load.op = "load (COPY)";
+	load.rows = rows;
+	load.seconds = loadTimer.elapsed().wall / 1e9;
+	load.peak_rss_kb = peak_rss_kb();
+	load.success = true;
+	results.push_back(load);
+
+	auto db = make_shared<QCATDataSource>(connStr, gen.spec().name);
+	if(!db->goodConnection())
+		return results;
+
+	results.push_back(measure("field stats", rows, [&](QCATBenchResult*) {
+		return db->fieldStats().size() == gen.spec().columns.size() + 1;
+	}));
+
+	QCAT q = bench_qcat(db);
+	results.push_back(measure("clientRun", rows, [&](QCATBenchResult* r) {
+		q.setExecutionMethod(fem_client);
+		auto s = q.execute();
+		r->entropy = s.entropy;
+		r->surprise = s.surprise_mean;
+		return s.success;
+	}));
+	if(server_function_available(db)) {
+		results.push_back(measure("serverRun", rows, [&](QCATBenchResult* r) {
+			q.setExecutionMethod(fem_server);
+			auto s = q.execute();
+			q.setExecutionMethod(fem_client);
+			r->entropy = s.entropy;
+			r->surprise = s.surprise_mean;
+			return s.success;
+		}));
+	}
+	else
+		std::cout << "Skipping serverRun: qcat_server is not installed" << std::endl;
+	results.push_back(measure("topNMostSurprising", rows, [&](QCATBenchResult* r) {
+		auto top = q.topNMostSurprising(100, true);
+		if(top.empty())
+			return false;
+		r->surprise = top.front().surprise;
+		return true;
+	}));
+	results.push_back(measure("summaryAndSurprisals", rows, [&](QCATBenchResult* r) {
+		auto s = q.summaryAndSurprisals();
+		r->entropy = s.summary.entropy;
+		r->surprise = s.summary.surprise_mean;
+		return s.summary.success;
+	}));
+	results.push_back(measure("QCATNGram", rows, [&](QCATBenchResult* r) {
+		QCATNGram ngram(db);
+		ngram.setIndependentVariable("ts");
+		ngram.setDependentVariable("num_i");
+		ngram.setN(QCATNGRAM_DEFAULT_N);
+		auto s = ngram.executeNGram();
+		r->entropy = s.qcatsummary.entropy;
+		r->surprise = s.qcatsummary.surprise_mean;
+		return s.qcatsummary.success;
+	}));
+
+	return results;
+}
+
+void output_test_result(std::string name, bool result)
+{
+	std::cout << "Test: " << name << " : " << (result ? "SUCCESS" : "FAILURE") << std::endl;
+}
+
+void print_results(const std::vector<QCATBenchResult>& results)
+{
+	std::cout << boost::format("%-22s %10s %10s %14s %12s %8s\n") % "op" % "rows" % "seconds" % "rows/s" % "peak RSS MB" % "";
+	for(auto& r: results) {
+		std::cout << boost::format("%-22s %10d %10.3f %14.0f %12.1f %8s\n") % r.op % r.rows % r.seconds
+			% r.rowsPerSecond() % (r.peak_rss_kb / 1024.0) % (r.success ? "" : "FAILED");
+	}
+}
+
+/*
+ * Every run of the same query on the same generated table must agree on entropy, whichever path computed it
+ */
+bool check_consistency(const std::vector<QCATBenchResult>& results, const QCATBenchTolerance& tolerance)
+{
+	const QCATBenchResult* reference = NULL;
+	bool ok = true;
+	for(auto& r: results) {
+		if(r.op != "clientRun" && r.op != "serverRun" && r.op != "summaryAndSurprisals")
+			continue;
+		if(!r.success) {
+			ok = false;
+			continue;
+		}
+		if(!reference) {
+			reference = &r;
+			continue;
+		}
+		if(fabs(r.entropy - reference->entropy) > tolerance.entropy) {
+			std::cerr << "*** " << r.op << " entropy " << r.entropy << " disagrees with "
+				<< reference->op << " entropy " << reference->entropy << std::endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/*
+ * Compares one size's results against the baseline. A size with no recorded results fails, so an unrecorded
+ * baseline can't pass; single operations without an entry (e.g. newly added ones) are reported, not failed.
+ */
+bool check_regressions(const std::vector<QCATBenchResult>& results, const boost::property_tree::ptree& baseline,
+	const QCATBenchTolerance& tolerance)
+{
+	if(results.empty())
+		return false;
+	const std::string size = boost::lexical_cast<std::string>(results.front().rows);
+	auto recorded = baseline.get_child_optional(boost::property_tree::ptree::path_type("results/" + size, '/'));
+	if(!recorded || recorded->empty()) {
+		std::cerr << "*** No baseline recorded for " << size << " rows; record one with --update-baseline" << std::endl;
+		return false;
+	}
+
+	bool ok = true;
+	for(auto& r: results) {
+		auto entry = baseline.get_child_optional(boost::property_tree::ptree::path_type(
+			"results/" + boost::lexical_cast<std::string>(r.rows) + "/" + r.op, '/'));
+		if(!entry) {
+			std::cout << "  " << r.op << ": no baseline" << std::endl;
+			continue;
+		}
+
+		std::vector<std::string> failures;
+		if(!r.success)
+			failures.push_back("failed");
+
+		const double rps = entry->get<double>("rows_per_second", 0);
+		if(rps > 0 && r.seconds >= tolerance.min_seconds && r.rowsPerSecond() < rps * (1 - tolerance.throughput))
+			failures.push_back((boost::format("throughput %.0f rows/s, baseline %.0f") % r.rowsPerSecond() % rps).str());
+
+		const long rss = entry->get<long>("peak_rss_kb", 0);
+		if(rss > 0 && r.peak_rss_kb > rss * (1 + tolerance.memory))
+			failures.push_back((boost::format("peak RSS %.1f MB, baseline %.1f MB") % (r.peak_rss_kb / 1024.0) % (rss / 1024.0)).str());
+
+		auto entropy = entry->get_optional<double>("entropy");
+		if(entropy && fabs(r.entropy - *entropy) > tolerance.entropy)
+			failures.push_back((boost::format("entropy %.6f, baseline %.6f") % r.entropy % *entropy).str());
+
+		auto surprise = entry->get_optional<double>("surprise");
+		if(surprise && fabs(r.surprise - *surprise) > tolerance.surprise)
+			failures.push_back((boost::format("surprise %.6f, baseline %.6f") % r.surprise % *surprise).str());
+
+		std::cout << "  " << r.op << ": " << (failures.empty() ? "SUCCESS" : "FAILURE") << std::endl;
+		for(auto& f: failures)
+			std::cout << "    " << f << std::endl;
+		ok = ok && failures.empty();
+	}
+	return ok;
+}
+
+void record_baseline(const std::vector<QCATBenchResult>& results, boost::property_tree::ptree* baseline)
+{
+	for(auto& r: results) {
+		boost::property_tree::ptree entry;
+		entry.put("rows_per_second", (long)r.rowsPerSecond());
+		entry.put("peak_rss_kb", r.peak_rss_kb);
+		if(r.op == "clientRun" || r.op == "serverRun" || r.op == "summaryAndSurprisals" || r.op == "QCATNGram")
+			entry.put("entropy", r.entropy);
+		if(r.op != "load (COPY)" && r.op != "field stats")
+			entry.put("surprise", r.surprise);
+		baseline->put_child(boost::property_tree::ptree::path_type(
+			"results/" + boost::lexical_cast<std::string>(r.rows) + "/" + r.op, '/'), entry);
+	}
+}
+
+QCATBenchTolerance read_tolerance(const boost::property_tree::ptree& baseline)
+{
+	QCATBenchTolerance tolerance;
+	tolerance.throughput = baseline.get("tolerance.throughput", tolerance.throughput);
+	tolerance.memory = baseline.get("tolerance.memory", tolerance.memory);
+	tolerance.entropy = baseline.get("tolerance.entropy", tolerance.entropy);
+	tolerance.surprise = baseline.get("tolerance.surprise", tolerance.surprise);
+	tolerance.min_seconds = baseline.get("tolerance.min_seconds", tolerance.min_seconds);
+	return tolerance;
+}
+
+void usage()
+{
+	std::cout << "benchmark [--conn CONNSTR] [--sizes N,N,...] [--seed N]" << std::endl
+		<< "  Loads generated tables qcat_bench_<N> into the given database (default \"" DEFAULT_CONNSTR "\")" << std::endl
+		<< "  and times each QCAT execution path on them." << std::endl
+		<< "benchmark --regress [--baseline FILE] [--update-baseline] [--conn CONNSTR]" << std::endl
+		<< "  Runs the size matrix and seed from the baseline (default " DEFAULT_BASELINE ") and fails" << std::endl
+		<< "  when throughput, peak memory, entropy or surprise drift past its tolerances." << std::endl
+		<< "  --update-baseline records this run's results as the new baseline instead." << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	std::string connStr = DEFAULT_CONNSTR;
+	std::string sizes = DEFAULT_SIZES;
+	std::string baselineFile = DEFAULT_BASELINE;
+	uint32_t seed = DEFAULT_SEED;
+	bool regress = false, updateBaseline = false;
+
+	for(int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if(arg == "--conn" && i + 1 < argc)
+			connStr = argv[++i];
+		else if(arg == "--sizes" && i + 1 < argc)
+			sizes = argv[++i];
+		else if(arg == "--seed" && i + 1 < argc)
+			seed = boost::lexical_cast<uint32_t>(argv[++i]);
+		else if(arg == "--regress")
+			regress = true;
+		else if(arg == "--baseline" && i + 1 < argc)
+			baselineFile = argv[++i];
+		else if(arg == "--update-baseline")
+			regress = updateBaseline = true;
+		else {
+			usage();
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+	cout << "--------------------" << endl;
+	cout << "QCAT Benchmark Suite" << endl;
+	cout << "--------------------" << endl;
+
+	boost::property_tree::ptree baseline;
+	QCATBenchTolerance tolerance;
+	if(regress) {
+		try {
+			boost::property_tree::read_json(baselineFile, baseline);
+		}
+		catch(const boost::property_tree::json_parser_error& e) {
+			std::cerr << "*** Unable to read benchmark baseline " << baselineFile << ": " << e.what() << std::endl;
+			return 1;
+		}
+		// the matrix is fixed by the baseline so results stay comparable
+		sizes = baseline.get("sizes", sizes);
+		seed = baseline.get("seed", seed);
+		tolerance = read_tolerance(baseline);
+	}
+
+	std::vector<std::string> sizeList;
+	boost::split(sizeList, sizes, boost::is_any_of(","));
+
+	bool ok = true;
+	for(auto& size: sizeList) {
+		const long rows = boost::lexical_cast<long>(size);
+		cout << endl << rows << " rows, seed " << seed << endl;
+
+		auto results = run_benchmarks(connStr, rows, seed);
+		if(results.empty()) {
+			std::cerr << "*** Unable to load benchmark table of " << rows << " rows" << std::endl;
+			ok = false;
+			continue;
+		}
+		print_results(results);
+
+		const bool consistent = check_consistency(results, tolerance);
+		output_test_result("Entropy consistent across execution paths", consistent);
+		ok = ok && consistent;
+
+		if(updateBaseline)
+			record_baseline(results, &baseline);
+		else if(regress)
+			ok = check_regressions(results, baseline, tolerance) && ok;
+	}
+
+	if(updateBaseline) {
+		if(!ok) {
+			std::cerr << "*** Not updating " << baselineFile << " from a failed run" << std::endl;
+			return 1;
+		}
+		boost::property_tree::write_json(baselineFile, baseline);
+		std::cout << endl << "Baseline written to " << baselineFile << std::endl;
+	}
+	else if(regress)
+		output_test_result("Performance regression", ok);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+#include "../qcatdatasource.h"
+#include "../qcatbinnumeric.h"
+#include "../qcatbintimestamp.h"
+#include "../qcatbinpassthrough.h"
+#include "../qcatbinquantile.h"
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+#define CONNSTR "dbname=flight_database user=postgres password=duke3d"
+#define TABLE "facas_simple_test"
+#define SAMPLES 2000
+#define SEED 1234
+
+auto db = make_shared<QCATDataSource>(CONNSTR, TABLE);
+
+std::string result_str(bool result)
+{
+	return result ? "SUCCESS" : "FAILURE";
+}
+
+void output_test_result(std::string name, bool result)
+{
+	std::cout << "Test: " << name << " : " << result_str(result) << std::endl;
+}
+
+/*
+ * Bins the values on the server with the bin's SQL (values given to it as sqlType, passed through wrap)
+ * and natively, and checks every bin number matches. If given, replaceFrom is replaced by replaceTo in
+ * the bin's SQL, e.g. to evaluate it as an older server would.
+ */
+bool bins_match(const QCATBin& bin, const std::vector<double>& values, std::string sqlType, std::string wrap = "v",
+	std::string replaceFrom = "", std::string replaceTo = "")
+{
+	std::string arr;
+	for(auto v: values)
+		arr += boost::lexical_cast<std::string>(v) + ",";
+	arr = arr.substr(0, arr.size()-1);
+
+	std::string binSQL = bin.sqlAttrToBin(wrap);
+	if(!replaceFrom.empty())
+		boost::replace_all(binSQL, replaceFrom, replaceTo);
+
+	const std::string sql = "SELECT " + binSQL + " AS b FROM unnest(ARRAY[" + arr + "]::" + sqlType + "[]) "
+		"WITH ORDINALITY AS t(v, i) ORDER BY i";
+
+	bool success;
+	auto rows = db->executeSQL(sql, &success);
+	if(!success || rows->nrows() != (int)values.size())
+		return false;
+
+	std::vector<int32_t> native(values.size());
+	bin.bin(values.data(), values.size(), native.data());
+
+	int mismatches = 0;
+	for(size_t i = 0; i < values.size(); ++i) {
+		if(rows->getInt(i, "b") != native[i]) {
+			if(mismatches++ < 5)
+				std::cout << "\t" << values[i] << ": SQL " << rows->get(i, "b") << ", native " << native[i] << std::endl;
+		}
+	}
+	return mismatches == 0;
+}
+
+int main()
+{
+	cout << "-------------------" << endl;
+	cout << "QCAT Binning Test" << endl;
+	cout << "-------------------" << endl;
+
+	std::mt19937 rng(SEED);
+	std::uniform_int_distribution<int> ints(-5000, 5000);
+	std::uniform_real_distribution<double> reals(-500.0, 500.0);
+
+	// integers, including exact multiples and halves of the widths below
+	std::vector<double> intValues;
+	for(int i = 0; i < SAMPLES; i++)
+		intValues.push_back(ints(rng));
+	for(int i = -20; i <= 20; i++)
+		intValues.push_back(i);
+
+	// doubles on a grid of quarters, so that ties come up for every width below
+	std::vector<double> doubleValues;
+	for(int i = 0; i < SAMPLES; i++)
+		doubleValues.push_back(round(reals(rng) * 4) / 4.0);
+
+	// timestamps as whole seconds since the epoch, including half-minute boundaries
+	std::vector<double> timeValues;
+	std::uniform_int_distribution<int> seconds(1300000000, 1500000000);
+	for(int i = 0; i < SAMPLES; i++)
+		timeValues.push_back(seconds(rng));
+	for(int i = 0; i < 20; i++)
+		timeValues.push_back(1400000000 + i * 30);
+
+	QCATBinInteger integer;
+	integer.setBinWidth(5);
+	output_test_result("Integer, integral width", bins_match(integer, intValues, "int"));
+	integer.setBinWidth(2.5);
+	output_test_result("Integer, fractional width", bins_match(integer, intValues, "int"));
+
+	QCATBinDouble dbl;
+	dbl.setBinWidth(0.5);
+	output_test_result("Double, width 0.5", bins_match(dbl, doubleValues, "float8"));
+	dbl.setBinWidth(3);
+	output_test_result("Double, width 3", bins_match(dbl, doubleValues, "float8"));
+
+	// extract(epoch) is numeric from Postgres 14 and double precision before it, so ties round differently;
+	// date_part() is still double precision, so it stands in for extract() on an older server
+	QCATBinTimestamp ts(true), tsDouble(false);
+	if(db->serverVersion() >= 140000) {
+		output_test_result("Timestamp, 15 minutes, numeric epoch", bins_match(ts, timeValues, "float8", "to_timestamp(v)"));
+		ts.setBinWidth(60*24);
+		output_test_result("Timestamp, 1 day, numeric epoch", bins_match(ts, timeValues, "float8", "to_timestamp(v)"));
+	}
+	else
+		std::cout << "Test: Timestamp, numeric epoch : SKIPPED (server before Postgres 14)" << std::endl;
+	output_test_result("Timestamp, 15 minutes, double epoch",
+		bins_match(tsDouble, timeValues, "float8", "to_timestamp(v)", "extract(epoch from ", "date_part('epoch', "));
+	tsDouble.setBinWidth(60*24);
+	output_test_result("Timestamp, 1 day, double epoch",
+		bins_match(tsDouble, timeValues, "float8", "to_timestamp(v)", "extract(epoch from ", "date_part('epoch', "));
+
+	// natively, a tie on an even bin rounds up with a numeric epoch and down with a double one
+	QCATBinTimestamp tieNumeric(true), tieDouble(false);
+	tieNumeric.setBinWidth(1);
+	tieDouble.setBinWidth(1);
+	const double tie = 250100000 + 2 * 60 + 30;	// 2.5 minutes after the bin origin
+	int32_t numericBin, doubleBin;
+	tieNumeric.bin(&tie, 1, &numericBin);
+	tieDouble.bin(&tie, 1, &doubleBin);
+	output_test_result("Timestamp tie rounding modes", numericBin == 3 && doubleBin == 2);
+
+	QCATBinPassthrough pass(fft_integer);
+	output_test_result("Passthrough integer", bins_match(pass, intValues, "int"));
+
+	QCATBinQuantile quantile(fft_double, boost::assign::list_of(-250.0)(-10.0)(0.0)(0.25)(100.0));
+	output_test_result("Quantile", bins_match(quantile, doubleValues, "float8"));
+}
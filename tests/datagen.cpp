@@ -0,0 +1,158 @@
+#include "datagen.h"
+#include <iostream>
+#include <algorithm>
+#include <math.h>
+#include <time.h>
+#include <boost/lexical_cast.hpp>
+
+#define TIMESTAMP_BASE 1388534400	// 2014-01-01 00:00:00 UTC
+#define COPY_BUFFER_BYTES (1 << 20)
+
+std::string QCATBenchColumn::sqlType() const
+{
+	switch(type) {
+		case bct_integer: return "integer";
+		case bct_double: return "double precision";
+		case bct_boolean: return "boolean";
+		case bct_timestamp: return "timestamp without time zone";
+		default: return "character varying";
+	}
+}
+
+std::string QCATBenchColumn::value(int rank) const
+{
+	switch(type) {
+		case bct_integer: return boost::lexical_cast<std::string>(rank);
+		case bct_double: return boost::lexical_cast<std::string>(rank * 0.5 + 0.25);
+		case bct_boolean: return rank % 2 ? "f" : "t";
+		case bct_string: return name + "_" + boost::lexical_cast<std::string>(rank);
+		default: return "";
+	}
+}
+
+QCATDataGenerator::QCATDataGenerator(QCATBenchTableSpec spec)
+	:m_spec(spec)
+{
+	// cumulative Zipf weights 1/k^s over each column's ranks
+	for(auto& col: m_spec.columns) {
+		std::vector<double> cdf(std::max(1, col.cardinality));
+		double total = 0;
+		for(size_t k = 0; k < cdf.size(); ++k) {
+			total += 1.0 / pow(k + 1.0, col.skew);
+			cdf[k] = total;
+		}
+		for(auto& c: cdf)
+			c /= total;
+		m_cdfs.push_back(cdf);
+	}
+	reset();
+}
+
+void QCATDataGenerator::reset()
+{
+	m_state = m_spec.seed * 0x9E3779B97F4A7C15ULL + 1;
+	m_row = 0;
+}
+
+double QCATDataGenerator::uniform()
+{
+	// splitmix64; 53 bits into [0,1)
+	uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z = z ^ (z >> 31);
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int QCATDataGenerator::sampleRank(size_t column)
+{
+	const auto& cdf = m_cdfs[column];
+	return std::min<int>(std::upper_bound(cdf.begin(), cdf.end(), uniform()) - cdf.begin(), cdf.size() - 1);
+}
+
+bool QCATDataGenerator::next(std::vector<std::string>* values)
+{
+	if(m_row >= m_spec.rows)
+		return false;
+
+	values->resize(m_spec.columns.size());
+	for(size_t c = 0; c < m_spec.columns.size(); ++c) {
+		const auto& col = m_spec.columns[c];
+		if(col.type == bct_timestamp) {
+			const time_t t = TIMESTAMP_BASE + m_row * (time_t)col.interval + (time_t)(uniform() * col.interval / 2);
+			struct tm tm;
+			gmtime_r(&t, &tm);
+			char buf[32];
+			strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+			(*values)[c] = buf;
+		}
+		else
+			(*values)[c] = col.value(sampleRank(c));
+	}
+	++m_row;
+	return true;
+}
+
+static bool exec(PGconn* conn, std::string sql)
+{
+	PGresult* r = PQexec(conn, sql.c_str());
+	const bool ok = PQresultStatus(r) == PGRES_COMMAND_OK;
+	if(!ok)
+		std::cerr << "*** QCATDataGenerator: " << PQerrorMessage(conn) << std::endl;
+	PQclear(r);
+	return ok;
+}
+
+bool QCATDataGenerator::load(std::string connStr)
+{
+	PGconn* conn = PQconnectdb(connStr.c_str());
+	if(PQstatus(conn) == CONNECTION_BAD) {
+		std::cerr << "*** QCATDataGenerator was unable to connect with connection string " << connStr << std::endl;
+		PQfinish(conn);
+		return false;
+	}
+
+	std::string create = "CREATE TABLE " + m_spec.name + " (id bigint PRIMARY KEY";
+	for(auto& col: m_spec.columns)
+		create += ", " + col.name + " " + col.sqlType();
+	create += ")";
+
+	bool ok = exec(conn, "DROP TABLE IF EXISTS " + m_spec.name)
+		&& exec(conn, "DROP TABLE IF EXISTS " + m_spec.name + "_stats")
+		&& exec(conn, create);
+
+	PGresult* r = PQexec(conn, ("COPY " + m_spec.name + " FROM STDIN").c_str());
+	ok = ok && PQresultStatus(r) == PGRES_COPY_IN;
+	PQclear(r);
+
+	if(ok) {
+		reset();
+		std::string buffer;
+		std::vector<std::string> values;
+		for(long id = 0; ok && next(&values); ++id) {
+			buffer += boost::lexical_cast<std::string>(id);
+			for(auto& v: values)
+				buffer += "\t" + v;
+			buffer += "\n";
+
+			if(buffer.size() > COPY_BUFFER_BYTES) {
+				ok = PQputCopyData(conn, buffer.data(), buffer.size()) == 1;
+				buffer.clear();
+			}
+		}
+		if(ok && !buffer.empty())
+			ok = PQputCopyData(conn, buffer.data(), buffer.size()) == 1;
+		ok = PQputCopyEnd(conn, ok ? NULL : "generator failed") == 1 && ok;
+
+		while((r = PQgetResult(conn)) != NULL) {
+			ok = ok && PQresultStatus(r) == PGRES_COMMAND_OK;
+			PQclear(r);
+		}
+		if(!ok)
+			std::cerr << "*** QCATDataGenerator: COPY failed: " << PQerrorMessage(conn) << std::endl;
+	}
+
+	ok = ok && exec(conn, "ANALYZE " + m_spec.name);
+	PQfinish(conn);
+	return ok;
+}
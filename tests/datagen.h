@@ -0,0 +1,89 @@
+#ifndef QCATDATAGEN_H
+#define QCATDATAGEN_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "libpq-fe.h"
+
+enum QCATBenchColumnType
+{
+	bct_integer = 0,
+	bct_double = 1,
+	bct_string = 2,
+	bct_boolean = 3,
+	bct_timestamp = 4
+};
+
+/*!
+ * \brief A generated column. Values are drawn from `cardinality` ranks with Zipfian skew (0 for uniform);
+ * timestamp columns instead advance by `interval` seconds per row, with up to half an interval of jitter.
+ */
+struct QCATBenchColumn
+{
+	QCATBenchColumn(std::string name, QCATBenchColumnType type, int cardinality = 10, double skew = 0, int interval = 60)
+		:name(name), type(type), cardinality(cardinality), skew(skew), interval(interval) {}
+
+	std::string name;
+	QCATBenchColumnType type;
+	int cardinality;
+	double skew;
+	int interval;
+
+	std::string sqlType() const;
+
+	/*!
+	 * \brief The value of a given rank (as loaded, so as text)
+	 */
+	std::string value(int rank) const;
+};
+
+struct QCATBenchTableSpec
+{
+	QCATBenchTableSpec()
+		:rows(0), seed(1) {}
+
+	std::string name;
+	long rows;
+	uint32_t seed;
+	std::vector<QCATBenchColumn> columns;
+};
+
+/*!
+ * \brief Deterministic generator for benchmark tables. The same spec and seed always give the same rows, on
+ * any platform (the generator uses its own sampling rather than the implementation-defined std distributions).
+ */
+class QCATDataGenerator
+{
+public:
+	QCATDataGenerator(QCATBenchTableSpec spec);
+
+	/*!
+	 * \brief Starts again from the first row
+	 */
+	void reset();
+
+	/*!
+	 * \brief Fills the values of the next row, one per column (text, as loaded); the id is the row number
+	 * \return False once all rows have been produced
+	 */
+	bool next(std::vector<std::string>* values);
+
+	/*!
+	 * \brief (Re)creates the table with an id primary key and loads every row with COPY, then runs ANALYZE
+	 */
+	bool load(std::string connStr);
+
+	const QCATBenchTableSpec& spec() const { return m_spec; }
+
+private:
+	double uniform();
+	int sampleRank(size_t column);
+
+	QCATBenchTableSpec m_spec;
+	std::vector<std::vector<double> > m_cdfs;
+	uint64_t m_state;
+	long m_row;
+};
+
+#endif // QCATDATAGEN_H